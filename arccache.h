@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include "nodepool.h"
+#include "flatindex.h"
+
+// Adaptive Replacement Cache (Megiddo and Modha). Entries seen once sit in a
+// recency list T1 and entries seen again move to a frequency list T2, each
+// kept most recently used first. Keys evicted from T1 and T2 are remembered,
+// without their values, in the ghost lists B1 and B2. A put for a key in B1
+// means T1 was too small and grows its target size p, a put for a key in B2
+// shrinks it, and evictions take from T1 while it is over p and from T2
+// otherwise. So the cache drifts towards LRU in recency-heavy phases and
+// towards LFU-like behaviour in frequency-heavy ones.
+//
+// T1 and B1 together never exceed the capacity and all four lists never
+// exceed twice the capacity, so there are at most capacity ghosts, each
+// costing a key, two links and an index slot.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class ARCCache {
+    private:
+        enum Which : uint8_t { T1, T2, B1, B2 };
+
+        // A ghost is a bare Link, a resident a Node
+        struct Link {
+            Key key;
+            Link* prev;
+            Link* next;
+            Which list;
+
+            template <typename K>
+            Link(K&& key, Which list)
+                : key(std::forward<K>(key)), prev(nullptr), next(nullptr), list(list) {}
+        };
+
+        struct Node : Link {
+            Value val;
+
+            template <typename K, typename... Args>
+            Node(K&& key, Which list, Args&&... args)
+                : Link(std::forward<K>(key), list), val(std::forward<Args>(args)...) {}
+        };
+
+        struct List {
+            Link* mru;
+            Link* lru;
+            std::size_t size;
+        };
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        using Slot = typename FlatIndex<Link*, Rebind<Link*>>::Slot;
+
+        // Residents and ghosts
+        FlatIndex<Link*, Rebind<Link*>> index;
+
+        List lists[4];
+
+        // Target size of T1
+        std::size_t p;
+
+        int maxcap;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        NodePool<Node, Rebind<Node>> nodepool;
+        NodePool<Link, Rebind<Link>> ghostpool;
+
+        template <typename K>
+        Slot* lookup(const K& key, std::size_t hash) {
+            return index.find(hash, [&](Link* l) { return equal(l->key, key); });
+        }
+
+        void unlink(Link* l) {
+            List& list = lists[l->list];
+            if (l->prev != nullptr)
+                l->prev->next = l->next;
+            else
+                list.mru = l->next;
+            if (l->next != nullptr)
+                l->next->prev = l->prev;
+            else
+                list.lru = l->prev;
+            list.size--;
+        }
+
+        void pushFront(Which which, Link* l) {
+            List& list = lists[which];
+            l->list = which;
+            l->prev = nullptr;
+            l->next = list.mru;
+            if (list.mru != nullptr)
+                list.mru->prev = l;
+            else
+                list.lru = l;
+            list.mru = l;
+            list.size++;
+        }
+
+        bool full(void) const {
+            return lists[T1].size + lists[T2].size >= (std::size_t)maxcap;
+        }
+
+        // Turns the least recently used resident of from into a ghost
+        void demote(Which from) {
+            Link* old = lists[from].lru;
+            Slot* slot = lookup(old->key, hasher(old->key));
+            unlink(old);
+            Link* ghost = ghostpool.create(std::move(old->key), from == T1 ? B1 : B2);
+            nodepool.destroy(static_cast<Node*>(old));
+            pushFront(ghost->list, ghost);
+            slot->val = ghost;
+        }
+
+        // Forgets the least recently used of list, resident or ghost
+        void drop(Which which) {
+            Link* old = lists[which].lru;
+            index.erase(lookup(old->key, hasher(old->key)));
+            unlink(old);
+            if (which == T1 or which == T2)
+                nodepool.destroy(static_cast<Node*>(old));
+            else
+                ghostpool.destroy(old);
+        }
+
+        // Makes room for one resident. A key coming back from B2 breaks a tie
+        // at p in favour of evicting from T1.
+        void replace(bool fromB2) {
+            std::size_t t1 = lists[T1].size;
+            if (lists[T2].size == 0 or (t1 > 0 and (t1 > p or (fromB2 and t1 == p))))
+                demote(T1);
+            else
+                demote(T2);
+        }
+
+        // Makes room for a key found nowhere in the cache or its ghosts
+        void admit(void) {
+            std::size_t t1b1 = lists[T1].size + lists[B1].size;
+            if (t1b1 >= (std::size_t)maxcap) {
+                if (lists[T1].size < (std::size_t)maxcap) {
+                    drop(B1);
+                    if (full())
+                        replace(false);
+                }
+                else
+                    drop(T1);
+            }
+            else if (t1b1 + lists[T2].size + lists[B2].size >= (std::size_t)maxcap) {
+                if (t1b1 + lists[T2].size + lists[B2].size >= 2 * (std::size_t)maxcap)
+                    drop(B2);
+                if (full())
+                    replace(false);
+            }
+        }
+
+    public:
+        ARCCache(int capacity, const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                 const Alloc& alloc = Alloc())
+            : index(capacity > 0 ? 2 * capacity : 0, Rebind<Link*>(alloc)),
+              lists{}, p(0), maxcap(capacity), hasher(hasher), equal(equal),
+              nodepool(capacity > 0 ? capacity : 0, true, Rebind<Node>(alloc)),
+              ghostpool(capacity > 0 ? capacity : 0, true, Rebind<Link>(alloc)) {}
+
+        ARCCache(const ARCCache&) = delete;
+        ARCCache& operator=(const ARCCache&) = delete;
+
+        ~ARCCache(void) {
+            for (Which which : {T1, T2, B1, B2}) {
+                while (lists[which].mru != nullptr) {
+                    Link* old = lists[which].mru;
+                    lists[which].mru = old->next;
+                    if (which == T1 or which == T2)
+                        nodepool.destroy(static_cast<Node*>(old));
+                    else
+                        ghostpool.destroy(old);
+                }
+            }
+        }
+
+        // Returns the cached value and moves it to the front of T2, or
+        // nullptr. A ghost is a miss and only counts once its key is put.
+        template <typename K>
+        Value* get(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr or slot->val->list >= B1)
+                return nullptr;
+            Link* l = slot->val;
+            unlink(l);
+            pushFront(T2, l);
+            return &static_cast<Node*>(l)->val;
+        }
+
+        // Returns the cached value without moving it, or nullptr. Ghosts are
+        // not cached.
+        template <typename K>
+        Value* peek(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr or slot->val->list >= B1)
+                return nullptr;
+            return &static_cast<Node*>(slot->val)->val;
+        }
+
+        // Inserts or overwrites the value for key. A key remembered in B1 or
+        // B2 adapts p and goes straight to T2, a new key goes to T1.
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            if (maxcap <= 0)
+                return;
+            std::size_t hash = hasher(key);
+            Slot* slot = lookup(key, hash);
+            Which to = T1;
+            if (slot != nullptr) {
+                Link* l = slot->val;
+                if (l->list <= T2) {
+                    static_cast<Node*>(l)->val = std::forward<V>(val);
+                    unlink(l);
+                    pushFront(T2, l);
+                    return;
+                }
+                std::size_t b1 = lists[B1].size;
+                std::size_t b2 = lists[B2].size;
+                bool fromB2 = l->list == B2;
+                if (fromB2)
+                    p -= std::min(p, b1 > b2 ? b1 / b2 : 1);
+                else
+                    p = std::min((std::size_t)maxcap, p + (b2 > b1 ? b2 / b1 : 1));
+                index.erase(slot);
+                unlink(l);
+                ghostpool.destroy(l);
+                if (full())
+                    replace(fromB2);
+                to = T2;
+            }
+            else
+                admit();
+            Node* n = nodepool.create(std::forward<K>(key), to, std::forward<V>(val));
+            pushFront(to, n);
+            index.insert(hash)->val = n;
+        }
+
+        // Removes key and moves its value out, if resident
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr or slot->val->list >= B1)
+                return std::nullopt;
+            Node* n = static_cast<Node*>(slot->val);
+            index.erase(slot);
+            unlink(n);
+            std::optional<Value> val (std::move(n->val));
+            nodepool.destroy(n);
+            return val;
+        }
+
+        // Resident entries, ghosts not included
+        std::size_t size(void) const {
+            return lists[T1].size + lists[T2].size;
+        }
+
+        std::size_t ghosts(void) const {
+            return lists[B1].size + lists[B2].size;
+        }
+
+        int capacity(void) const {
+            return maxcap;
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) + index.bytes() + nodepool.bytes() + ghostpool.bytes();
+        }
+};
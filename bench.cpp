@@ -0,0 +1,400 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "davidcache.h"
+#include "markcache.h"
+#include "compactcache.h"
+#include "lrucache.h"
+#include "tinylfu.h"
+#include "sampledcache.h"
+#include "arccache.h"
+#include "gdsfcache.h"
+#include "blobcache.h"
+#include "smallcache.h"
+#include "shardedcache.h"
+#include "concurrentcache.h"
+#include "trace.h"
+#include "perfcounters.h"
+#include "histogram.h"
+
+// Benchmark of one or more engines over a trace, reported as JSON. Each
+// engine is replayed three times from empty, skipping the first warmup ops
+// of the trace in what is measured:
+//   1. untimed per op, for throughput and hit ratio, and the hardware
+//      counters if asked for
+//   2. each op timed into a Histogram, for latency percentiles
+//   3. peeking at each put's key first, to count evictions
+// so that neither the timer nor the bookkeeping disturbs the throughput run.
+
+// How the benchmark drives an engine. Engines whose get returns a pointer and
+// that have peek, size and bytes need nothing more, the overloads after these
+// cover the rest.
+template <typename Cache>
+bool benchGet(Cache& cache, int key) {
+    return cache.get(key) != nullptr;
+}
+
+template <typename Cache>
+void benchPut(Cache& cache, int key, int val) {
+    cache.put(key, val);
+}
+
+template <typename Cache>
+bool benchPeek(Cache& cache, int key) {
+    return cache.peek(key) != nullptr;
+}
+
+template <typename Cache>
+std::size_t benchSize(Cache& cache) {
+    return cache.size();
+}
+
+template <typename Cache>
+std::size_t benchBytes(Cache& cache) {
+    return cache.bytes();
+}
+
+bool benchGet(LFUCacheCompact& cache, int key) {
+    return cache.get(key) != -1;
+}
+
+bool benchPeek(LFUCacheCompact& cache, int key) {
+    return cache.peek(key) != -1;
+}
+
+// Values stored as 4 byte blobs
+bool benchGet(BlobLFUCache<int>& cache, int key) {
+    return (bool)cache.get(key);
+}
+
+void benchPut(BlobLFUCache<int>& cache, int key, int val) {
+    cache.put(key, std::string_view((const char*)&val, sizeof(val)));
+}
+
+bool benchPeek(BlobLFUCache<int>& cache, int key) {
+    return (bool)cache.peek(key);
+}
+
+// Values come back as copies in a std::optional
+bool benchGet(ShardedLFUCache<int,int>& cache, int key) {
+    return cache.get(key).has_value();
+}
+
+bool benchPeek(ShardedLFUCache<int,int>& cache, int key) {
+    return cache.peek(key).has_value();
+}
+
+bool benchGet(ConcurrentLFUCache<int,int>& cache, int key) {
+    return cache.get(key).has_value();
+}
+
+bool benchPeek(ConcurrentLFUCache<int,int>& cache, int key) {
+    return cache.peek(key).has_value();
+}
+
+bool benchGet(LFUCache& cache, int key) {
+    return lFUCacheGet(&cache, key) != -1;
+}
+
+void benchPut(LFUCache& cache, int key, int val) {
+    lFUCachePut(&cache, key, val);
+}
+
+bool benchPeek(LFUCache& cache, int key) {
+    return map_contains(cache.item_map, key);
+}
+
+std::size_t benchSize(LFUCache& cache) {
+    return cache.size;
+}
+
+std::size_t benchBytes(LFUCache& cache) {
+    return lFUCacheBytes(&cache);
+}
+
+struct Options {
+    int capacity;
+    std::size_t warmup;
+    // Counted around the throughput run if set
+    PerfCounters* perf;
+};
+
+struct Result {
+    double opspersec;
+    double hitratio;
+    uint64_t evictions;
+    double p50, p99, p999;
+    std::size_t bytes;
+    uint64_t counts[PerfCounters::ncounters];
+};
+
+// Runs the three passes over a fresh cache from make() each time, and frees
+// each with drop()
+template <typename Make, typename Drop>
+Result bench(const Trace& ops, const Options& opts, Make make, Drop drop) {
+    Result res = {};
+    std::size_t warmup = std::min(opts.warmup, ops.size());
+    std::size_t measured = ops.size() - warmup;
+
+    auto warm = [&](auto& cache) {
+        for (std::size_t i = 0; i < warmup; i++) {
+            if (ops[i].op == 'g')
+                benchGet(cache, ops[i].key);
+            else
+                benchPut(cache, ops[i].key, ops[i].val);
+        }
+    };
+
+    {
+        auto* cache = make();
+        warm(*cache);
+        uint64_t gets = 0, hits = 0;
+        if (opts.perf != nullptr)
+            opts.perf->start();
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = warmup; i < ops.size(); i++) {
+            if (ops[i].op == 'g') {
+                gets++;
+                hits += benchGet(*cache, ops[i].key);
+            }
+            else
+                benchPut(*cache, ops[i].key, ops[i].val);
+        }
+        auto stop = std::chrono::steady_clock::now();
+        if (opts.perf != nullptr) {
+            opts.perf->stop();
+            for (int c = 0; c < PerfCounters::ncounters; c++)
+                res.counts[c] = opts.perf->count((PerfCounters::Counter)c);
+        }
+        std::chrono::duration<double> runtime = stop - start;
+        res.opspersec = runtime.count() > 0 ? measured / runtime.count() : 0;
+        res.hitratio = gets > 0 ? (double)hits / gets : 0;
+        res.bytes = benchBytes(*cache);
+        drop(cache);
+    }
+
+    {
+        auto* cache = make();
+        warm(*cache);
+        Histogram hist;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t first = ticks();
+        for (std::size_t i = warmup; i < ops.size(); i++) {
+            uint64_t before = ticks();
+            if (ops[i].op == 'g')
+                benchGet(*cache, ops[i].key);
+            else
+                benchPut(*cache, ops[i].key, ops[i].val);
+            hist.record(ticks() - before);
+        }
+        uint64_t last = ticks();
+        auto stop = std::chrono::steady_clock::now();
+        double nspertick = last > first
+            ? std::chrono::duration<double, std::nano>(stop - start).count() / (last - first) : 0;
+        res.p50 = hist.quantile(0.5) * nspertick;
+        res.p99 = hist.quantile(0.99) * nspertick;
+        res.p999 = hist.quantile(0.999) * nspertick;
+        drop(cache);
+    }
+
+    // Gets never evict, so every insert either grew the cache or pushed
+    // something out
+    {
+        auto* cache = make();
+        warm(*cache);
+        std::size_t startsize = benchSize(*cache);
+        uint64_t inserts = 0;
+        for (std::size_t i = warmup; i < ops.size(); i++) {
+            if (ops[i].op == 'g')
+                benchGet(*cache, ops[i].key);
+            else {
+                inserts += not benchPeek(*cache, ops[i].key);
+                benchPut(*cache, ops[i].key, ops[i].val);
+            }
+        }
+        res.evictions = inserts - (benchSize(*cache) - startsize);
+        drop(cache);
+    }
+
+    return res;
+}
+
+template <typename Cache, typename Make>
+Result bench(const Trace& ops, const Options& opts, Make make) {
+    return bench(ops, opts, make, [](Cache* cache) { delete cache; });
+}
+
+// SmallLFUCache for the capacities it is instantiated at, false for others
+template <std::size_t N, std::size_t... Ns>
+bool benchSmall(const Trace& ops, const Options& opts, Result& res) {
+    if (opts.capacity == (int)N) {
+        res = bench<SmallLFUCache<N>>(ops, opts, []() { return new SmallLFUCache<N>(); });
+        return true;
+    }
+    if constexpr (sizeof...(Ns) > 0)
+        return benchSmall<Ns...>(ops, opts, res);
+    else
+        return false;
+}
+
+// Runs engine by name, returns false if there is no such engine or it does
+// not support the capacity
+bool run(const std::string& engine, const Trace& ops, const Options& opts, Result& res) {
+    int cap = opts.capacity;
+    if (engine == "mark")
+        res = bench<LFUCacheMark<int,int>>(ops, opts, [&]() { return new LFUCacheMark<int,int>(cap); });
+    else if (engine == "mark-unpooled")
+        res = bench<LFUCacheMark<int,int>>(ops, opts, [&]() { return new LFUCacheMark<int,int>(cap, false); });
+    else if (engine == "mark-aging")
+        res = bench<LFUCacheMark<int,int>>(ops, opts, [&]() { return new LFUCacheMark<int,int>(cap, true, true); });
+    else if (engine == "tinylfu")
+        res = bench<WTinyLFUCache<int,int>>(ops, opts, [&]() { return new WTinyLFUCache<int,int>(cap); });
+    else if (engine == "sampled")
+        res = bench<SampledLFUCache<int,int>>(ops, opts, [&]() { return new SampledLFUCache<int,int>(cap); });
+    else if (engine == "arc")
+        res = bench<ARCCache<int,int>>(ops, opts, [&]() { return new ARCCache<int,int>(cap); });
+    else if (engine == "gdsf")
+        res = bench<GDSFCache<int,int>>(ops, opts, [&]() { return new GDSFCache<int,int>(cap); });
+    // Budget of 64 bytes a value on top of the index
+    else if (engine == "blob")
+        res = bench<BlobLFUCache<int>>(ops, opts, [&]() {
+            BlobLFUCache<int> sizing (0, cap);
+            return new BlobLFUCache<int>(sizing.bytes() + (uint64_t)cap * 64, cap);
+        });
+    else if (engine == "lru")
+        res = bench<LRUCache<int,int>>(ops, opts, [&]() { return new LRUCache<int,int>(cap); });
+    else if (engine == "compact")
+        res = bench<LFUCacheCompact>(ops, opts, [&]() { return new LFUCacheCompact(cap); });
+    // Default 16 shards, run from one thread, so the cost of the locks and
+    // read buffers over a plain cache
+    else if (engine == "sharded")
+        res = bench<ShardedLFUCache<int,int>>(ops, opts, [&]() { return new ShardedLFUCache<int,int>(cap); });
+    else if (engine == "concurrent")
+        res = bench<ConcurrentLFUCache<int,int>>(ops, opts, [&]() { return new ConcurrentLFUCache<int,int>(cap); });
+    else if (engine == "small")
+        return benchSmall<1, 2, 4, 8, 10, 16, 32, 64>(ops, opts, res);
+    else if (engine == "c")
+        res = bench(ops, opts, [&]() { return lFUCacheCreate(cap); }, [](LFUCache* cache) { lFUCacheFree(cache); });
+    else
+        return false;
+    return true;
+}
+
+// s as a JSON string literal
+static std::string quoted(const char* s) {
+    std::string out = "\"";
+    for (; *s != '\0'; s++) {
+        if (*s == '"' or *s == '\\')
+            out += '\\';
+        out += *s;
+    }
+    return out + "\"";
+}
+
+static const char* engines[] = {
+    "mark", "mark-unpooled", "mark-aging", "tinylfu", "sampled", "arc", "gdsf",
+    "blob", "lru", "compact", "sharded", "concurrent", "small", "c",
+};
+
+// bench [options] trace
+//   --engine a,b,...  engines to run, or all (all)
+//   --capacity n      entries per cache (10)
+//   --warmup n        ops replayed before measuring (0)
+//   --perf            also report hardware counters per op, null for those
+//                     that cannot be opened
+// trace is a binary trace, or - to read text ops from stdin. Engines that do
+// not support the capacity are skipped.
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
+
+    Options opts = {10, 0, nullptr};
+    bool perf = false;
+    std::string list = "all";
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (std::strcmp(argv[i], "--engine") == 0 and more)
+            list = argv[++i];
+        else if (std::strcmp(argv[i], "--capacity") == 0 and more)
+            opts.capacity = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--warmup") == 0 and more)
+            opts.warmup = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--perf") == 0)
+            perf = true;
+        else if ((argv[i][0] != '-' or argv[i][1] == '\0') and path == nullptr)
+            path = argv[i];
+        else {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (path == nullptr or opts.capacity <= 0) {
+        std::cerr << "Usage: bench [--engine a,b,...] [--capacity n] [--warmup n] [--perf] trace" << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    if (list == "all")
+        names.assign(std::begin(engines), std::end(engines));
+    else {
+        for (std::size_t start = 0; start <= list.size();) {
+            std::size_t comma = std::min(list.find(',', start), list.size());
+            names.push_back(list.substr(start, comma - start));
+            start = comma + 1;
+        }
+    }
+
+    Trace ops;
+    if (std::strcmp(path, "-") == 0 ? not ops.read(std::cin) : not ops.map(path)) {
+        std::cerr << "Could not load ops from " << path << std::endl;
+        return 1;
+    }
+
+    PerfCounters counters;
+    if (perf) {
+        opts.perf = &counters;
+        if (not counters.any())
+            std::cerr << "No hardware counters available, reporting them as null" << std::endl;
+    }
+
+    std::cout << "{\"trace\": " << quoted(path) << ", \"ops\": " << ops.size()
+              << ", \"capacity\": " << opts.capacity << ", \"warmup\": " << opts.warmup
+              << ", \"results\": [";
+    bool first = true;
+    for (const std::string& name : names) {
+        Result res;
+        if (not run(name, ops, opts, res)) {
+            std::cerr << "Skipping " << name << std::endl;
+            continue;
+        }
+        std::cout << (first ? "" : ",") << "\n  {\"engine\": \"" << name << "\""
+                  << ", \"ops_per_sec\": " << res.opspersec
+                  << ", \"hit_ratio\": " << res.hitratio
+                  << ", \"evictions\": " << res.evictions
+                  << ", \"latency_ns\": {\"p50\": " << res.p50 << ", \"p99\": " << res.p99
+                  << ", \"p99.9\": " << res.p999 << "}"
+                  << ", \"bytes\": " << res.bytes;
+        if (perf) {
+            std::size_t measured = ops.size() - std::min(opts.warmup, ops.size());
+            std::cout << ", \"per_op\": {";
+            for (int c = 0; c < PerfCounters::ncounters; c++) {
+                std::cout << (c > 0 ? ", " : "") << "\"" << PerfCounters::names[c] << "\": ";
+                if (counters.available((PerfCounters::Counter)c) and measured > 0)
+                    std::cout << (double)res.counts[c] / measured;
+                else
+                    std::cout << "null";
+            }
+            std::cout << "}";
+        }
+        std::cout << "}";
+        first = false;
+    }
+    std::cout << "\n]}" << std::endl;
+    return 0;
+}
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "markcache.h"
+
+// LFU cache of variable-length byte strings under a hard memory budget. Each
+// value is copied into a chunk from one of a ladder of size classes, 32 bytes
+// and up in steps of about 1/8, and a freed chunk waits on its class's free
+// list for the next value of that class. Values past the top class get a
+// chunk of their own size.
+//
+// The budget covers everything the cache holds: the LFUCacheMark that tracks
+// keys, counted as if full from the start, plus every chunk, whether live,
+// pinned after eviction or free. When a value does not fit the cache first
+// hands free chunks of other classes back to the allocator and then evicts
+// until it does.
+//
+// get returns a Handle, a zero-copy view of the value that pins its chunk, so
+// an entry evicted or overwritten while a Handle is alive keeps its bytes
+// until the Handle goes away. Handles must not outlive the cache: destroying
+// it frees every chunk, pinned or not.
+template <typename Key,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<Key>>
+class BlobLFUCache {
+    private:
+        struct Blob {
+            // Next chunk on a free list, or neighbours on the list of
+            // retired chunks still pinned
+            Blob* nextfree;
+            Blob* prevpinned;
+            uint32_t pins;
+            uint32_t length;
+            // Index into classes, or huge
+            uint16_t sclass;
+            bool live;
+
+            char* data(void) {
+                return reinterpret_cast<char*>(this + 1);
+            }
+        };
+
+        static constexpr uint16_t huge = UINT16_MAX;
+        static constexpr std::size_t minchunk = 32;
+        static constexpr std::size_t maxchunk = 1 << 20;
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        using ChunkAlloc = Rebind<std::max_align_t>;
+        using ChunkTraits = std::allocator_traits<ChunkAlloc>;
+
+        LFUCacheMark<Key, Blob*, Hash, KeyEqual, Rebind<std::pair<const Key, Blob*>>> cache;
+
+        // Chunk size of each class and each class's free list
+        std::vector<uint32_t, Rebind<uint32_t>> classes;
+        std::vector<Blob*, Rebind<Blob*>> freelists;
+
+        ChunkAlloc alloc;
+
+        uint64_t budget;
+        // Bytes of the cache itself and of all chunks
+        uint64_t metadata;
+        uint64_t held;
+        // Of which on free lists
+        uint64_t idle;
+
+        // Chunks of evicted or overwritten entries waiting for their last
+        // Handle
+        Blob* pinned;
+
+        // Bytes of the chunk holding b
+        std::size_t chunkSize(const Blob* b) const {
+            return chunkFor(b->sclass, b->length);
+        }
+
+        Blob* allocate(std::size_t chunk) {
+            std::size_t units = (chunk + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+            held += chunk;
+            return reinterpret_cast<Blob*>(ChunkTraits::allocate(alloc, units));
+        }
+
+        void deallocate(Blob* b) {
+            std::size_t chunk = chunkSize(b);
+            std::size_t units = (chunk + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+            held -= chunk;
+            ChunkTraits::deallocate(alloc, reinterpret_cast<std::max_align_t*>(b), units);
+        }
+
+        // Puts a chunk nobody uses any more on its free list
+        void recycle(Blob* b) {
+            if (b->sclass == huge) {
+                deallocate(b);
+                return;
+            }
+            b->nextfree = freelists[b->sclass];
+            freelists[b->sclass] = b;
+            idle += classes[b->sclass];
+        }
+
+        // Hands one free chunk back to the allocator, returns false if there
+        // are none
+        bool shed(void) {
+            for (std::size_t c = 0; c < freelists.size(); c++) {
+                if (freelists[c] != nullptr) {
+                    Blob* b = freelists[c];
+                    freelists[c] = b->nextfree;
+                    idle -= classes[c];
+                    deallocate(b);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Drops the entry and its chunk unless the chunk is pinned, in which
+        // case the last Handle frees it
+        void retire(Blob* b) {
+            b->live = false;
+            if (b->pins == 0) {
+                recycle(b);
+                return;
+            }
+            b->prevpinned = nullptr;
+            b->nextfree = pinned;
+            if (pinned != nullptr)
+                pinned->prevpinned = b;
+            pinned = b;
+        }
+
+        // An entry being overwritten has no chunk while its new one is found
+        bool evictOne(void) {
+            const Key* victim = cache.victim();
+            if (victim == nullptr)
+                return false;
+            Key key = *victim;
+            Blob* b = *cache.extract(key);
+            if (b != nullptr)
+                retire(b);
+            return true;
+        }
+
+        // Size class of the chunk for length bytes, or huge
+        uint16_t sizeClass(std::size_t length) const {
+            std::size_t need = sizeof(Blob) + length;
+            if (need > classes.back())
+                return huge;
+            return std::lower_bound(classes.begin(), classes.end(), (uint32_t)need) - classes.begin();
+        }
+
+        std::size_t chunkFor(uint16_t sclass, std::size_t length) const {
+            return sclass == huge ? sizeof(Blob) + length : classes[sclass];
+        }
+
+        // Finds a chunk for length bytes, returns nullptr if it cannot fit
+        Blob* acquire(std::size_t length) {
+            uint16_t sclass = sizeClass(length);
+            std::size_t need = chunkFor(sclass, length);
+            Blob* b = nullptr;
+            for (;;) {
+                if (sclass != huge and freelists[sclass] != nullptr) {
+                    b = freelists[sclass];
+                    freelists[sclass] = b->nextfree;
+                    idle -= need;
+                    break;
+                }
+                if (metadata + held + need <= budget) {
+                    b = allocate(need);
+                    break;
+                }
+                if (shed())
+                    continue;
+                if (not evictOne())
+                    return nullptr;
+            }
+            b->nextfree = nullptr;
+            b->pins = 0;
+            b->length = length;
+            b->sclass = sclass;
+            b->live = true;
+            return b;
+        }
+
+        void unpin(Blob* b) {
+            if (--b->pins > 0 or b->live)
+                return;
+            if (b->prevpinned != nullptr)
+                b->prevpinned->nextfree = b->nextfree;
+            else
+                pinned = b->nextfree;
+            if (b->nextfree != nullptr)
+                b->nextfree->prevpinned = b->prevpinned;
+            recycle(b);
+        }
+
+    public:
+        // Zero-copy view of a cached value. Empty after a miss.
+        class Handle {
+            private:
+                friend class BlobLFUCache;
+
+                BlobLFUCache* owner;
+                Blob* blob;
+
+                Handle(BlobLFUCache* owner, Blob* blob) : owner(owner), blob(blob) {
+                    if (blob != nullptr)
+                        blob->pins++;
+                }
+
+            public:
+                Handle(void) : owner(nullptr), blob(nullptr) {}
+
+                Handle(Handle&& other) noexcept : owner(other.owner), blob(other.blob) {
+                    other.blob = nullptr;
+                }
+
+                Handle& operator=(Handle&& other) noexcept {
+                    if (this != &other) {
+                        if (blob != nullptr)
+                            owner->unpin(blob);
+                        owner = other.owner;
+                        blob = other.blob;
+                        other.blob = nullptr;
+                    }
+                    return *this;
+                }
+
+                Handle(const Handle&) = delete;
+                Handle& operator=(const Handle&) = delete;
+
+                ~Handle(void) {
+                    if (blob != nullptr)
+                        owner->unpin(blob);
+                }
+
+                explicit operator bool(void) const {
+                    return blob != nullptr;
+                }
+
+                std::string_view view(void) const {
+                    return blob != nullptr ? std::string_view(blob->data(), blob->length) : std::string_view();
+                }
+        };
+
+        // budget is in bytes and bounds everything the cache holds, maxentries
+        // sizes the key index. A budget too small for the index caches nothing.
+        BlobLFUCache(uint64_t budget, int maxentries,
+                     const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                     const Alloc& alloc = Alloc())
+            : cache(maxentries, true, false, hasher, equal, Rebind<std::pair<const Key, Blob*>>(alloc)),
+              classes(Rebind<uint32_t>(alloc)), freelists(Rebind<Blob*>(alloc)),
+              alloc(alloc), budget(budget), held(0), idle(0), pinned(nullptr) {
+            for (std::size_t size = minchunk; size <= maxchunk; size = (size + size / 8 + 15) & ~(std::size_t)15)
+                classes.push_back(size);
+            freelists.assign(classes.size(), nullptr);
+            metadata = sizeof(*this) - sizeof(cache) + cache.fullBytes()
+                + classes.capacity() * sizeof(uint32_t) + freelists.capacity() * sizeof(Blob*);
+        }
+
+        BlobLFUCache(const BlobLFUCache&) = delete;
+        BlobLFUCache& operator=(const BlobLFUCache&) = delete;
+
+        // Frees every chunk, including any still pinned, so no Handle may
+        // outlive the cache
+        ~BlobLFUCache(void) {
+            while (const Key* victim = cache.victim()) {
+                Key key = *victim;
+                Blob* b = *cache.extract(key);
+                if (b != nullptr) {
+                    assert(b->pins == 0 and "Handle outlived its BlobLFUCache");
+                    deallocate(b);
+                }
+            }
+            assert(pinned == nullptr and "Handle outlived its BlobLFUCache");
+            while (pinned != nullptr) {
+                Blob* b = pinned;
+                pinned = b->nextfree;
+                deallocate(b);
+            }
+            while (shed())
+                ;
+        }
+
+        // Returns a view of the value after counting a use, or an empty
+        // Handle
+        Handle get(const Key& key) {
+            Blob** b = cache.get(key);
+            return Handle(this, b != nullptr ? *b : nullptr);
+        }
+
+        // get without counting a use
+        Handle peek(const Key& key) {
+            Blob** b = cache.peek(key);
+            return Handle(this, b != nullptr ? *b : nullptr);
+        }
+
+        // Copies val in as the value for key, counting a use, and returns
+        // whether it fit. A value bigger than the whole budget, or than the
+        // 4 GiB a chunk can record, is turned away with the cache untouched.
+        // Otherwise an older value for key is dropped either way, and a value
+        // that only fails because pinned chunks hold the budget has still
+        // evicted what it could.
+        bool put(const Key& key, std::string_view val) {
+            if (cache.capacity() <= 0)
+                return false;
+            if (val.size() > UINT32_MAX)
+                return false;
+            if (metadata + chunkFor(sizeClass(val.size()), val.size()) > budget)
+                return false;
+            Blob** old = cache.get(key);
+            if (old != nullptr) {
+                Blob* prev = *old;
+                *old = nullptr;
+                if (prev != nullptr)
+                    retire(prev);
+            }
+            Blob* b = acquire(val.size());
+            // Finding room may have evicted key itself
+            Blob** slot = cache.peek(key);
+            if (b == nullptr) {
+                if (slot != nullptr)
+                    cache.extract(key);
+                return false;
+            }
+            std::memcpy(b->data(), val.data(), val.size());
+            if (slot != nullptr)
+                *slot = b;
+            else {
+                // Make room in the index ourselves, the cache would drop the
+                // victim's chunk
+                if (cache.size() >= (std::size_t)cache.capacity())
+                    evictOne();
+                cache.put(key, b);
+            }
+            return true;
+        }
+
+        bool erase(const Key& key) {
+            std::optional<Blob*> b = cache.extract(key);
+            if (not b.has_value())
+                return false;
+            if (*b != nullptr)
+                retire(*b);
+            return true;
+        }
+
+        std::size_t size(void) const {
+            return cache.size();
+        }
+
+        // Everything counted against the budget, never more than it unless
+        // the budget is too small for the index alone
+        std::size_t bytes(void) const {
+            return metadata + held;
+        }
+
+        // Bytes of chunks in use, live or pinned
+        std::size_t chunkBytes(void) const {
+            return held - idle;
+        }
+};
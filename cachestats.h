@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// What a cache built with CountingStats reports. Histograms have one bucket
+// per power of 2: probes[i] counts get, peek and put lookups that looked at
+// between 2^i and 2^(i+1) - 1 slots, listsizes[i] the frequency lists
+// currently holding between 2^i and 2^(i+1) - 1 entries. The last bucket
+// also takes anything larger.
+struct CacheStats {
+    static constexpr int buckets = 16;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t updates;
+    uint64_t evictions;
+    uint64_t probes[buckets];
+    uint64_t listsizes[buckets];
+
+    static int bucket(uint64_t n) {
+        int b = n > 0 ? 63 - __builtin_clzll(n) : 0;
+        return b < buckets ? b : buckets - 1;
+    }
+};
+
+// Statistics policies for a cache's Stats parameter. The cache derives from
+// its policy and calls these hooks on every event, so with NoStats the empty
+// base and empty hooks compile away to exactly the code of a cache without
+// them.
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    void hit(void) {}
+    void miss(void) {}
+    void insert(void) {}
+    void update(void) {}
+    void evict(void) {}
+    void probe(std::size_t) {}
+};
+
+// Plain counters in the cache object. The caches are not thread safe, so
+// whichever thread holds one is the only one updating its counters and they
+// need no atomics. The sharded front-ends use NoStats.
+class CountingStats {
+    private:
+        CacheStats counts;
+
+    public:
+        static constexpr bool enabled = true;
+
+        CountingStats(void) : counts() {}
+
+        void hit(void) {
+            counts.hits++;
+        }
+
+        void miss(void) {
+            counts.misses++;
+        }
+
+        void insert(void) {
+            counts.inserts++;
+        }
+
+        void update(void) {
+            counts.updates++;
+        }
+
+        void evict(void) {
+            counts.evictions++;
+        }
+
+        void probe(std::size_t slots) {
+            counts.probes[CacheStats::bucket(slots)]++;
+        }
+
+        const CacheStats& counters(void) const {
+            return counts;
+        }
+};
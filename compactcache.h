@@ -0,0 +1,246 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// LFUCacheMark laid out for memory rather than pointers. KeyVals live in one
+// array sized from the capacity and Sublists in a second array that only
+// grows to the number of distinct use counts, and everything links by 32-bit
+// index. The index is open addressing with 8 byte slots sized to exactly
+// 5/4 of the capacity, so a full cache carries 12 bytes of links and 10
+// bytes of index per entry on top of its 8 byte key and value.
+class LFUCacheCompact {
+    private:
+        static constexpr uint32_t nil = UINT32_MAX;
+
+        struct KeyVal {
+            int key;
+            int val;
+            uint32_t prevkv;
+            uint32_t nextkv;
+            uint32_t sublist;
+        };
+
+        struct Sublist {
+            uint32_t uses;
+            uint32_t most;
+            uint32_t least;
+            uint32_t prevsl;
+            uint32_t nextsl;
+        };
+
+        struct Slot {
+            int key;
+            uint32_t kv;
+        };
+
+        std::vector<KeyVal> kvs;
+        std::vector<Sublist> sls;
+        std::vector<Slot> slots;
+
+        // Released Sublists, chained through nextsl
+        uint32_t freesl;
+
+        uint32_t head;
+
+        std::size_t nslots;
+
+        int maxcap;
+
+        // Fibonacci hash mapped onto [0, nslots) by multiply and shift, which
+        // lets the table size be any number instead of a power of 2
+        std::size_t home(int key) const {
+            return ((uint64_t)((uint32_t)key * 2654435769u) * nslots) >> 32;
+        }
+
+        std::size_t next(std::size_t i) const {
+            return i + 1 == nslots ? 0 : i + 1;
+        }
+
+        // How far i lies past from, going around the table
+        std::size_t distance(std::size_t from, std::size_t i) const {
+            return i >= from ? i - from : i + nslots - from;
+        }
+
+        Slot* find(int key) {
+            for (std::size_t i = home(key);; i = next(i)) {
+                Slot& s = slots[i];
+                if (s.kv == nil)
+                    return nullptr;
+                if (s.key == key)
+                    return &s;
+            }
+        }
+
+        void insert(int key, uint32_t kv) {
+            std::size_t i = home(key);
+            while (slots[i].kv != nil)
+                i = next(i);
+            slots[i].key = key;
+            slots[i].kv = kv;
+        }
+
+        // Backward shift delete, see FlatIndex::erase
+        void erase(Slot* slot) {
+            std::size_t hole = slot - slots.data();
+            for (std::size_t i = next(hole); slots[i].kv != nil; i = next(i)) {
+                if (distance(home(slots[i].key), i) >= distance(hole, i)) {
+                    slots[hole] = slots[i];
+                    hole = i;
+                }
+            }
+            slots[hole].kv = nil;
+        }
+
+        uint32_t newSublist(uint32_t uses, uint32_t kv, uint32_t prevsl, uint32_t nextsl) {
+            uint32_t sl;
+            if (freesl != nil) {
+                sl = freesl;
+                freesl = sls[sl].nextsl;
+                sls[sl] = Sublist{uses, kv, kv, prevsl, nextsl};
+            }
+            else {
+                sl = sls.size();
+                sls.push_back(Sublist{uses, kv, kv, prevsl, nextsl});
+            }
+            kvs[kv].sublist = sl;
+            return sl;
+        }
+
+        // Unlinks sl from the sublist list and releases it
+        void freeSublist(uint32_t sl) {
+            Sublist& old = sls[sl];
+            if (old.prevsl != nil)
+                sls[old.prevsl].nextsl = old.nextsl;
+            else
+                head = old.nextsl;
+            if (old.nextsl != nil)
+                sls[old.nextsl].prevsl = old.prevsl;
+            old.nextsl = freesl;
+            freesl = sl;
+        }
+
+        // Same moves as LFUCacheMark::increment
+        void increment(uint32_t fkv) {
+            KeyVal& kv = kvs[fkv];
+            uint32_t fsl = kv.sublist;
+            uint32_t nsl = sls[fsl].nextsl;
+            if (sls[fsl].most == fkv and sls[fsl].least == fkv) {
+                sls[fsl].uses++;
+                if (nsl != nil and sls[nsl].uses == sls[fsl].uses) {
+                    kv.nextkv = sls[nsl].most;
+                    kvs[sls[nsl].most].prevkv = fkv;
+                    sls[nsl].most = fkv;
+                    kv.sublist = nsl;
+                    freeSublist(fsl);
+                }
+                return;
+            }
+            // Unlink from found sublist
+            if (kv.prevkv != nil)
+                kvs[kv.prevkv].nextkv = kv.nextkv;
+            else
+                sls[fsl].most = kv.nextkv;
+            if (kv.nextkv != nil)
+                kvs[kv.nextkv].prevkv = kv.prevkv;
+            else
+                sls[fsl].least = kv.prevkv;
+            kv.prevkv = nil;
+            kv.nextkv = nil;
+            // Insert into uses+1 sublist
+            uint32_t uses = sls[fsl].uses + 1;
+            if (nsl != nil and sls[nsl].uses == uses) {
+                kvs[sls[nsl].most].prevkv = fkv;
+                kv.nextkv = sls[nsl].most;
+                sls[nsl].most = fkv;
+                kv.sublist = nsl;
+            }
+            else {
+                // newSublist may grow sls, so no Sublist references past here
+                uint32_t sl = newSublist(uses, fkv, fsl, nsl);
+                sls[fsl].nextsl = sl;
+                if (nsl != nil)
+                    sls[nsl].prevsl = sl;
+            }
+        }
+
+    public:
+        LFUCacheCompact(int capacity) : freesl(nil), head(nil) {
+            maxcap = capacity;
+            kvs.reserve(capacity > 0 ? capacity : 0);
+            // Always leave at least one empty slot to end probes
+            nslots = capacity > 0 ? (std::size_t)capacity + capacity / 4 + 1 : 1;
+            slots.resize(nslots, Slot{0, nil});
+        }
+
+        int get(int key) {
+            Slot* s = find(key);
+            if (s == nullptr)
+                return -1;
+            increment(s->kv);
+            return kvs[s->kv].val;
+        }
+
+        // get without counting a use
+        int peek(int key) {
+            Slot* s = find(key);
+            return s != nullptr ? kvs[s->kv].val : -1;
+        }
+
+        void put(int key, int val) {
+            if (maxcap <= 0)
+                return;
+            Slot* s = find(key);
+            if (s != nullptr) {
+                increment(s->kv);
+                kvs[s->kv].val = val;
+                return;
+            }
+            uint32_t nkv;
+            if (kvs.size() < (std::size_t)maxcap) {
+                nkv = kvs.size();
+                kvs.push_back(KeyVal());
+            }
+            // Otherwise evict (Reuse the evictee)
+            else {
+                nkv = sls[head].least;
+                erase(find(kvs[nkv].key));
+                sls[head].least = kvs[nkv].prevkv;
+                if (kvs[nkv].prevkv != nil)
+                    kvs[kvs[nkv].prevkv].nextkv = nil;
+                else
+                    sls[head].most = nil;
+                if (sls[head].most == nil)
+                    freeSublist(head);
+            }
+            KeyVal& kv = kvs[nkv];
+            kv.key = key;
+            kv.val = val;
+            kv.prevkv = nil;
+            kv.nextkv = nil;
+            if (head == nil or sls[head].uses > 1) {
+                uint32_t sl = newSublist(1, nkv, nil, head);
+                if (head != nil)
+                    sls[head].prevsl = sl;
+                head = sl;
+            }
+            else {
+                kvs[sls[head].most].prevkv = nkv;
+                kv.nextkv = sls[head].most;
+                sls[head].most = nkv;
+                kv.sublist = head;
+            }
+            insert(key, nkv);
+        }
+
+        std::size_t size(void) const {
+            return kvs.size();
+        }
+
+        // Heap bytes held by the cache, including its own footprint
+        std::size_t bytes(void) const {
+            return sizeof(*this) + kvs.capacity() * sizeof(KeyVal)
+                + sls.capacity() * sizeof(Sublist) + slots.size() * sizeof(Slot);
+        }
+};
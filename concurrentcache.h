@@ -0,0 +1,273 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "markcache.h"
+
+// ThreadSanitizer sees the optimistic reads below race the writers they are
+// retried after, so they are hidden from it. Checked by concurrenttest.cpp.
+#if defined(__SANITIZE_THREAD__)
+#define LFU_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define LFU_TSAN
+#endif
+#endif
+
+#ifdef LFU_TSAN
+extern "C" void AnnotateIgnoreReadsBegin(const char* file, int line);
+extern "C" void AnnotateIgnoreReadsEnd(const char* file, int line);
+#endif
+
+// Sharded LFU cache whose reads take no lock. Each shard guards its
+// LFUCacheMark with a seqlock: writers hold the shard's maintenance mutex and
+// bump seq around every change, while readers look the key up and copy the
+// value optimistically, retrying if seq moved. That is only sound because the
+// shard's FlatIndex never reallocates and its node pools never hand memory
+// back, so a stale pointer still points into the cache, and because keys and
+// values must be trivially copyable, so a torn copy is just discarded bytes.
+//
+// A read cannot relink its KeyVal, so the hit is recorded in one of the
+// shard's read buffers instead, lossy rings that drop events when full the
+// way Caffeine's do. Whoever next holds the maintenance lock, a writer or a
+// reader that found its buffer full, replays the buffered hits in a batch.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class ConcurrentLFUCache {
+    static_assert(std::is_trivially_copyable_v<Key> and std::is_trivially_copyable_v<Value>,
+                  "ConcurrentLFUCache reads keys and values while they may be overwritten");
+
+    private:
+        using Cache = LFUCacheMark<Key, Value, Hash, KeyEqual, Alloc>;
+        using KeyVal = typename Cache::KeyVal;
+        using Entry = typename Cache::Entry;
+
+        // Events per read buffer and read buffers per shard, powers of 2
+        static constexpr uint32_t buffersize = 16;
+        static constexpr uint32_t stripes = 4;
+
+        struct alignas(64) ReadBuffer {
+            // Next event to claim, advanced by readers
+            std::atomic<uint32_t> tail {0};
+            // Next event to replay, advanced by the drainer
+            std::atomic<uint32_t> head {0};
+            std::atomic<KeyVal*> events[buffersize] {};
+        };
+
+        struct alignas(64) Shard {
+            // Odd while a writer is changing the cache
+            std::atomic<uint64_t> seq {0};
+            std::mutex maintenance;
+            Cache cache;
+            ReadBuffer buffers[stripes];
+
+            Shard(int capacity, const Hash& hasher, const KeyEqual& equal, const Alloc& alloc)
+                : cache(capacity, true, false, hasher, equal, alloc) {}
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        // Same shard choice as ShardedLFUCache
+        Shard& shardFor(std::size_t hash) {
+            uint64_t h = hash;
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return *shards[((h & 0xffffffffull) * shards.size()) >> 32];
+        }
+
+        // Threads are dealt read buffers round robin
+        static uint32_t stripe(void) {
+            static std::atomic<uint32_t> nextstripe (0);
+            thread_local uint32_t id = nextstripe.fetch_add(1, std::memory_order_relaxed);
+            return id & (stripes - 1);
+        }
+
+        static void beginWrite(Shard& shard) {
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        static void endWrite(Shard& shard) {
+            shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        // Queues a hit on kv, dropping it if the buffer is full or another
+        // reader claimed the same event. Returns true once the buffer is full.
+        static bool record(ReadBuffer& buf, KeyVal* kv) {
+            uint32_t head = buf.head.load(std::memory_order_acquire);
+            uint32_t tail = buf.tail.load(std::memory_order_relaxed);
+            if (tail - head >= buffersize)
+                return true;
+            if (not buf.tail.compare_exchange_strong(tail, tail + 1, std::memory_order_relaxed))
+                return false;
+            buf.events[tail & (buffersize - 1)].store(kv, std::memory_order_release);
+            return tail + 1 - head >= buffersize;
+        }
+
+        // Counts the buffered hits. Must hold the maintenance lock inside a
+        // write. A KeyVal evicted since its hit was recorded is skipped, or
+        // if it was already reused, its new key gets the use.
+        static void drain(Shard& shard) {
+            Cache& cache = shard.cache;
+            for (ReadBuffer& buf : shard.buffers) {
+                uint32_t head = buf.head.load(std::memory_order_relaxed);
+                uint32_t tail = buf.tail.load(std::memory_order_acquire);
+                for (; head != tail; head++) {
+                    std::atomic<KeyVal*>& event = buf.events[head & (buffersize - 1)];
+                    KeyVal* kv = event.load(std::memory_order_acquire);
+                    // Claimed but not yet written, pick it up next time
+                    if (kv == nullptr)
+                        break;
+                    event.store(nullptr, std::memory_order_relaxed);
+                    auto slot = cache.lookup(kv->key, cache.hasher(kv->key));
+                    if (slot != nullptr and slot->val.second == kv)
+                        slot->val.first = cache.increment(slot->val.first, kv);
+                }
+                buf.head.store(head, std::memory_order_release);
+            }
+        }
+
+        // Looks key up in shard under the seqlock, copying its value into val.
+        // Returns the KeyVal it was read from, or nullptr.
+        KeyVal* read(Shard& shard, std::size_t hash, const Key& key, unsigned char* val) {
+            KeyVal* found;
+            for (;;) {
+                uint64_t seq = shard.seq.load(std::memory_order_acquire);
+                if (seq & 1) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                found = nullptr;
+#ifdef LFU_TSAN
+                AnnotateIgnoreReadsBegin(__FILE__, __LINE__);
+#endif
+                shard.cache.cachemap.peek(hash, [&](const Entry& e) {
+                    // A slot can be seen claimed before its entry is written
+                    KeyVal* kv = __atomic_load_n(&e.second, __ATOMIC_RELAXED);
+                    if (kv == nullptr or not equal(kv->key, key))
+                        return false;
+                    found = kv;
+                    return true;
+                });
+                if (found != nullptr)
+                    std::memcpy(val, &found->val, sizeof(Value));
+#ifdef LFU_TSAN
+                AnnotateIgnoreReadsEnd(__FILE__, __LINE__);
+#endif
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (shard.seq.load(std::memory_order_relaxed) == seq)
+                    return found;
+            }
+        }
+
+        void tryDrain(Shard& shard) {
+            std::unique_lock<std::mutex> guard (shard.maintenance, std::try_to_lock);
+            if (not guard.owns_lock())
+                return;
+            beginWrite(shard);
+            drain(shard);
+            endWrite(shard);
+        }
+
+    public:
+        // The capacity is split across nshards shards, the first
+        // capacity % nshards taking one entry more, so the shards add up to
+        // exactly capacity. There are never more shards than entries.
+        ConcurrentLFUCache(int capacity, int nshards = 16,
+                           const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                           const Alloc& alloc = Alloc())
+            : hasher(hasher), equal(equal) {
+            if (capacity > 0 and nshards > capacity)
+                nshards = capacity;
+            if (nshards < 1)
+                nshards = 1;
+            int shardcap = capacity > 0 ? capacity / nshards : 0;
+            int extra = capacity > 0 ? capacity % nshards : 0;
+            for (int i = 0; i < nshards; i++)
+                shards.push_back(std::make_unique<Shard>(shardcap + (i < extra), hasher, equal, alloc));
+        }
+
+        // Returns a copy of the cached value without taking a lock. The use is
+        // counted once the shard's read buffers are drained.
+        std::optional<Value> get(const Key& key) {
+            std::size_t hash = hasher(key);
+            Shard& shard = shardFor(hash);
+            alignas(Value) unsigned char val[sizeof(Value)];
+            KeyVal* found = read(shard, hash, key, val);
+            if (found == nullptr)
+                return std::nullopt;
+            if (record(shard.buffers[stripe()], found))
+                tryDrain(shard);
+            return *std::launder(reinterpret_cast<Value*>(val));
+        }
+
+        // get without counting a use
+        std::optional<Value> peek(const Key& key) {
+            std::size_t hash = hasher(key);
+            alignas(Value) unsigned char val[sizeof(Value)];
+            if (read(shardFor(hash), hash, key, val) == nullptr)
+                return std::nullopt;
+            return *std::launder(reinterpret_cast<Value*>(val));
+        }
+
+        void put(const Key& key, const Value& val) {
+            Shard& shard = shardFor(hasher(key));
+            std::lock_guard<std::mutex> guard (shard.maintenance);
+            beginWrite(shard);
+            drain(shard);
+            shard.cache.put(key, val);
+            endWrite(shard);
+        }
+
+        std::optional<Value> extract(const Key& key) {
+            Shard& shard = shardFor(hasher(key));
+            std::lock_guard<std::mutex> guard (shard.maintenance);
+            beginWrite(shard);
+            drain(shard);
+            std::optional<Value> val = shard.cache.extract(key);
+            endWrite(shard);
+            return val;
+        }
+
+        std::size_t shardCount(void) const {
+            return shards.size();
+        }
+
+        // Sum over the shards, each counted under its own lock
+        std::size_t size(void) {
+            std::size_t total = 0;
+            for (auto& shard : shards) {
+                std::lock_guard<std::mutex> guard (shard->maintenance);
+                total += shard->cache.size();
+            }
+            return total;
+        }
+
+        std::size_t bytes(void) {
+            std::size_t total = sizeof(*this) + shards.capacity() * sizeof(shards[0]);
+            for (auto& shard : shards) {
+                std::lock_guard<std::mutex> guard (shard->maintenance);
+                total += shard->cache.bytes() - sizeof(Cache) + sizeof(Shard);
+            }
+            return total;
+        }
+};
@@ -0,0 +1,232 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "markcache.h"
+#include "shardedcache.h"
+#include "concurrentcache.h"
+
+// Stress test of the thread-safe front-ends against a single-threaded
+// LFUCacheMark. Meant to be built with -fsanitize=thread as well as without:
+//   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread concurrenttest.cpp
+//
+// Which entries survive eviction under concurrent writers depends on the
+// interleaving, so the threaded checks are built to have one right answer:
+//   1. No eviction. Each thread puts and extracts only its own keys while
+//      getting everyone's, so the final contents must equal a model that
+//      replays each thread's writes.
+//   2. Heavy eviction. Anything left must hold the value its key was last
+//      put with, and the cache must not hold more than its capacity.
+//   3. One thread on one shard. Reads only defer their uses to the next
+//      write, which replays them in order first, so the contents must match
+//      an LFUCacheMark of the same capacity exactly, evictions and all.
+// Every value carries its key in the high half, so a torn or misdirected read
+// is caught the moment a get returns it.
+
+using Model = LFUCacheMark<int, uint64_t>;
+
+// A write by one thread, replayed into the model afterwards
+struct Write {
+    int key;
+    // 0 for an extract
+    uint64_t val;
+};
+
+static uint64_t tagged(int key, uint32_t version) {
+    return (uint64_t)(uint32_t)key << 32 | version;
+}
+
+static int failures = 0;
+
+static void fail(const char* cache, const char* check, const std::string& what) {
+    std::cout << cache << ": " << check << ": " << what << std::endl;
+    failures++;
+}
+
+// Runs nthreads threads of random ops over keys 0..nkeys-1, thread t owning
+// the keys k with k % nthreads == t, then replays every thread's writes into
+// model, which must have room for all nkeys.
+template <typename Cache>
+void hammer(Cache& cache, Model& model, const char* name, const char* check,
+            unsigned nthreads, int nkeys, uint64_t ops, uint64_t seed) {
+    std::vector<std::vector<Write>> writes (nthreads);
+    std::atomic<uint64_t> torn (0);
+    std::atomic<bool> go (false);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nthreads; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937_64 rng (seed * 1000003 + t);
+            int owned = (nkeys - (int)t + (int)nthreads - 1) / (int)nthreads;
+            uint32_t version = 0;
+            while (not go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (uint64_t i = 0; i < ops; i++) {
+                uint64_t r = rng();
+                unsigned what = r % 10;
+                if (what < 6) {
+                    int key = (r >> 8) % nkeys;
+                    std::optional<uint64_t> val = cache.get(key);
+                    if (val.has_value() and (int)(*val >> 32) != key)
+                        torn++;
+                    continue;
+                }
+                int key = (int)(((r >> 8) % owned) * nthreads + t);
+                if (what < 9) {
+                    uint64_t val = tagged(key, ++version);
+                    cache.put(key, val);
+                    writes[t].push_back({key, val});
+                }
+                else {
+                    std::optional<uint64_t> val = cache.extract(key);
+                    if (val.has_value() and (int)(*val >> 32) != key)
+                        torn++;
+                    writes[t].push_back({key, 0});
+                }
+            }
+        });
+    }
+    go.store(true, std::memory_order_release);
+    for (std::thread& thread : threads)
+        thread.join();
+    if (torn.load() > 0)
+        fail(name, check, std::to_string(torn.load()) + " reads returned another key's value");
+
+    for (const std::vector<Write>& ws : writes) {
+        for (const Write& w : ws) {
+            if (w.val != 0)
+                model.put(w.key, w.val);
+            else
+                model.extract(w.key);
+        }
+    }
+}
+
+template <typename Cache>
+void noEviction(const char* name, unsigned nthreads, uint64_t ops, uint64_t seed) {
+    const char* check = "no eviction";
+    int nkeys = 4096;
+    // Room for every key in every shard, however they hash
+    Cache cache (nkeys * 16, 16);
+    Model model (nkeys);
+    hammer(cache, model, name, check, nthreads, nkeys, ops, seed);
+    int wrong = 0;
+    for (int key = 0; key < nkeys; key++) {
+        std::optional<uint64_t> got = cache.peek(key);
+        uint64_t* want = model.peek(key);
+        if (got.has_value() != (want != nullptr) or (want != nullptr and *got != *want))
+            wrong++;
+    }
+    if (wrong > 0)
+        fail(name, check, std::to_string(wrong) + " keys differ from the model");
+    if (cache.size() != model.size())
+        fail(name, check, "size " + std::to_string(cache.size()) + ", model has " + std::to_string(model.size()));
+}
+
+template <typename Cache>
+void eviction(const char* name, unsigned nthreads, uint64_t ops, uint64_t seed) {
+    const char* check = "eviction";
+    int nkeys = 4096, capacity = 256;
+    Cache cache (capacity, 16);
+    Model model (nkeys);
+    hammer(cache, model, name, check, nthreads, nkeys, ops, seed);
+    int wrong = 0;
+    std::size_t found = 0;
+    for (int key = 0; key < nkeys; key++) {
+        std::optional<uint64_t> got = cache.peek(key);
+        uint64_t* want = model.peek(key);
+        if (got.has_value() and (want == nullptr or *got != *want))
+            wrong++;
+        found += got.has_value();
+    }
+    if (wrong > 0)
+        fail(name, check, std::to_string(wrong) + " keys hold a value other than their last put");
+    if (cache.size() != found or found > (std::size_t)capacity)
+        fail(name, check, "size " + std::to_string(cache.size()) + ", found " + std::to_string(found)
+                          + " keys, capacity " + std::to_string(capacity));
+}
+
+template <typename Cache>
+void singleThread(const char* name, uint64_t ops, uint64_t seed) {
+    const char* check = "single thread";
+    int nkeys = 512, capacity = 64;
+    Cache cache (capacity, 1);
+    Model model (capacity);
+    std::mt19937_64 rng (seed);
+    uint32_t version = 0;
+    int wrong = 0;
+    for (uint64_t i = 0; i < ops; i++) {
+        uint64_t r = rng();
+        // Skewed keys, so uses pile up and decide evictions
+        int key = (int)(((r >> 8) % nkeys) * ((r >> 40) % nkeys) / nkeys);
+        unsigned what = r % 10;
+        if (what < 6) {
+            std::optional<uint64_t> got = cache.get(key);
+            uint64_t* want = model.get(key);
+            if (got.has_value() != (want != nullptr) or (want != nullptr and *got != *want))
+                wrong++;
+        }
+        else if (what < 9) {
+            uint64_t val = tagged(key, ++version);
+            cache.put(key, val);
+            model.put(key, val);
+        }
+        else {
+            std::optional<uint64_t> got = cache.extract(key);
+            std::optional<uint64_t> want = model.extract(key);
+            if (got != want)
+                wrong++;
+        }
+    }
+    for (int key = 0; key < nkeys; key++) {
+        std::optional<uint64_t> got = cache.peek(key);
+        uint64_t* want = model.peek(key);
+        if (got.has_value() != (want != nullptr) or (want != nullptr and *got != *want))
+            wrong++;
+    }
+    if (wrong > 0)
+        fail(name, check, std::to_string(wrong) + " ops or keys differ from the model");
+}
+
+template <typename Cache>
+void all(const char* name, unsigned nthreads, uint64_t ops, uint64_t seed) {
+    noEviction<Cache>(name, nthreads, ops, seed);
+    eviction<Cache>(name, nthreads, ops, seed);
+    singleThread<Cache>(name, ops, seed);
+}
+
+// concurrenttest [options]
+//   --threads n   threads for the threaded checks (4)
+//   --ops n       ops per thread (200000)
+//   --seed n      random seed (1)
+// Prints each failed check and exits with 1 if any failed.
+int main(int argc, char** argv) {
+    unsigned nthreads = 4;
+    uint64_t ops = 200000, seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (std::strcmp(argv[i], "--threads") == 0 and more)
+            nthreads = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--ops") == 0 and more)
+            ops = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--seed") == 0 and more)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else {
+            std::cerr << "Usage: concurrenttest [--threads n] [--ops n] [--seed n]" << std::endl;
+            return 1;
+        }
+    }
+
+    all<ShardedLFUCache<int, uint64_t>>("ShardedLFUCache", nthreads, ops, seed);
+    all<ConcurrentLFUCache<int, uint64_t>>("ConcurrentLFUCache", nthreads, ops, seed);
+    if (failures > 0)
+        return 1;
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
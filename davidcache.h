@@ -1,3 +1,40 @@
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//building with LFU_STATS defined makes the cache and its map count hits,
+//misses, inserts, updates, evictions and probe lengths for lFUCacheStats,
+//without it LFU_STAT drops its arguments and nothing is counted
+#ifdef LFU_STATS
+#define LFU_STAT(...) __VA_ARGS__
+
+//histograms have one bucket per power of 2, the last also takes anything larger
+#define LFU_STATS_BUCKETS 16
+
+typedef struct
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long inserts;
+    unsigned long long updates;
+    unsigned long long evictions;
+    // map lookups that probed between 2^i and 2^(i+1) - 1 groups
+    unsigned long long probes[LFU_STATS_BUCKETS];
+    // frequency lists currently holding between 2^i and 2^(i+1) - 1 items
+    unsigned long long list_sizes[LFU_STATS_BUCKETS];
+} lfu_stats;
+
+static inline int _lfu_stats_bucket(unsigned long long n)
+{
+    int b = n > 0 ? 63 - __builtin_clzll(n) : 0;
+    return b < LFU_STATS_BUCKETS ? b : LFU_STATS_BUCKETS - 1;
+}
+#else
+#define LFU_STAT(...)
+#endif
+
 typedef struct
 {
     int key;
@@ -6,70 +43,67 @@ typedef struct
 
 typedef struct
 {
-    bucket **buckets;
+    signed char *ctrl;
+    bucket *buckets;
     int size;
+    int growth_left;
+    // previous table while a resize is moving its entries over
+    signed char *old_ctrl;
+    bucket *old_buckets;
+    int old_size;
+    int migrate_pos;
     int num_keys;
     unsigned int (*hash_function)(int);
     int (*equality_function)(void *, void *);
     void (*free_key)(int);
     void (*free_value)(void *);
+#ifdef LFU_STATS
+    unsigned long long probes[LFU_STATS_BUCKETS];
+#endif
 } hash_map;
 
-typedef struct node
-{
-	void *data;
-	struct node *next;
-	struct node *prev;
-} node;
-
-typedef struct linked_list
-{
-	node *head;
-	node *tail;
-	size_t num_nodes;
-} linked_list;
-
-typedef struct
+typedef struct lfu_item
 {
     int key;
     int value;
     int freq;
+    // neighbours in the list of items with the same frequency
+    struct lfu_item *prev;
+    struct lfu_item *next;
+    struct freq_node *parent;
 } lfu_item;
 
+typedef struct freq_node
+{
+    int freq;
+    // items with this frequency, least recently used at the head
+    lfu_item *head;
+    lfu_item *tail;
+    struct freq_node *prev;
+    struct freq_node *next;
+} freq_node;
+
 typedef struct
 {
-    hash_map *freq_map;
     hash_map *item_map;
-    int min_freq;
+    // every item lives in this array, the item map points into it
+    lfu_item *items;
+    // preallocated frequency nodes, the unused ones chained through next
+    freq_node *freq_nodes;
+    freq_node *free_freq;
+    // frequency lists in increasing order of frequency, none of them empty
+    freq_node *freq_head;
     int size;
     int capacity;
+    // with aging on, the frequency of the last evicted item, new items start
+    // one above it instead of at 1
+    int age;
+    int aging;
+#ifdef LFU_STATS
+    lfu_stats stats;
+#endif
 } LFUCache;
 
-node *create_node(void *data)
-{
-    node *n = (node *)malloc(sizeof(node));
-    n->data = data;
-    n->next = NULL;
-    n->prev = NULL;
-    return n;
-}
-
-void free_node(node *n, void (*free_data)(void *))
-{
-    free_data(n->data);
-    free(n);
-}
-
-
-lfu_item *create_lfu_item(int key, int value)
-{
-    lfu_item *new_item = malloc(sizeof(lfu_item));
-    new_item->key = key;
-    new_item->value = value;
-    new_item->freq = 1;
-    return new_item;
-}
-
 /**
  * Utility function to update an existing lfu_item with the specified key and value
  */
@@ -80,199 +114,69 @@ lfu_item *update_lfu_item(lfu_item *item, int key, int value)
     return item;
 }
 
-void print_lfu_item(void *item) {
-    lfu_item* temp = ((lfu_item*)item);
-    printf("{Key:%d, Value:%d, Freq: %d}", temp->key, temp->value, temp->freq);
-}
-
-
-linked_list *create_linked_list()
-{
-    //	linked_list *list = (linked_list *)malloc(sizeof(linked_list));
-    //	list->head = list->tail = NULL;
-    //	list->num_nodes = 0;
-    linked_list *list = (linked_list *)calloc(1, sizeof(linked_list));
-    return list;
-}
-
-/**
- * Pushes node into list at the back
- * Makes the node the new tail
- */
-void push_back(linked_list *list, node *node)
-{
-    if (list->head == NULL)
-    {
-        list->head = list->tail = node;
-    }
-    else
-    {
-        list->tail->next = node;
-        node->prev = list->tail;
-        list->tail = node;
-    }
-    list->num_nodes++;
-}
-
-/**
- * Pushes node into list at the front
- * Makes the node the new head
- */
-void push_front(linked_list *list, node *node)
-{
-    if (list->head == NULL)
-    {
-        list->head = list->tail = node;
-    }
-    else
-    {
-        node->next = list->head;
-        list->head->prev = node;
-        list->head = node;
-    }
-    list->num_nodes++;
-}
-
-/**
- * Pops node at current head
- */
-node *pop_front(linked_list *list)
-{
-    node *node = list->head;
-    if (node == NULL)
-    {
-        return NULL;
-    }
-    if (node->next == NULL)
-    {
-        list->head = NULL;
-        list->tail = NULL;
-    }
-    else
-    {
-        list->head = list->head->next;
-        list->head->prev = NULL;
-        node->next = NULL;
-    }
-    list->num_nodes--;
-    return node;
-}
-
-/**
- * Pops node at current tail
- */
-node *pop_back(linked_list *list)
-{
-    node *node = list->tail;
-    if (node == NULL)
-    {
-        return NULL;
-    }
-    if (node->prev == NULL)
-    {
-        list->head = NULL;
-        list->tail = NULL;
-    }
-    else
-    {
-        list->tail = list->tail->prev;
-        list->tail->next = NULL;
-        node->prev = NULL;
-    }
-    list->num_nodes--;
-    return node;
-}
-
-/**
- * Pops node anywhere in list if possible
- */
-void pop_node(linked_list *list, node* node) {
-    if(node == NULL) {
-        perror("Null node cannot be removed!");
-        exit(EXIT_FAILURE);
-    }
-    if(list == NULL) {
-        perror("Null linked_list cannot be removed from!");
-        exit(EXIT_FAILURE);
-    }
+//control byte markers, full slots hold the low 7 bits of the hash (H2)
+#define CTRL_EMPTY ((signed char)-128)
+#define CTRL_DELETED ((signed char)-2)
 
-    //singleton
-    if(node->next == NULL && node->prev == NULL) {
-        pop_front(list);
-        return;
-    }
+//number of slots whose control bytes are scanned at once
+#define GROUP_WIDTH 16
 
-    //head
-    else if(node->next != NULL && node->prev == NULL){
-        pop_front(list);
+//number of groups moved out of the old table by each operation while resizing
+#define MIGRATE_GROUPS 2
 
-        return;
-    }
-
-    //tail
-    else if(node->next == NULL && node->prev != NULL) {
-        pop_back(list);
-
-        return;
-    }
-    
-    //middle node
-    else {
-
-        node->next->prev = node->prev;
-        node->prev->next = node->next;
-        node->next = NULL;
-        node->prev = NULL;
-        list->num_nodes--;
-        return;
-    }
-
-}
 /**
- * Check is linked list is empty
+ * Returns a bitmask of the slots in the group starting at ctrl whose control
+ * byte equals b
  */
-bool is_empty(linked_list *list) {
-    return list->head == NULL && list->tail == NULL;
+static inline unsigned int _group_match(const signed char *ctrl, signed char b)
+{
+#ifdef __SSE2__
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+#else
+   unsigned int mask = 0;
+   for (int i = 0; i < GROUP_WIDTH; i++)
+   {
+      if (ctrl[i] == b)
+         mask |= 1u << i;
+   }
+   return mask;
+#endif
 }
 
 /**
- * Print all nodes in linked list
+ * Returns a bitmask of the empty or deleted slots in the group starting at ctrl,
+ * both markers have the sign bit set while full slots never do
  */
-void print_list(linked_list *list, void (*print_function)(void *))
+static inline unsigned int _group_match_free(const signed char *ctrl)
 {
-    putchar('[');
-    node *cur = list->head;
-    if (cur != NULL)
-    {
-        print_function(cur->data);
-        cur = cur->next;
-    }
-    for (; cur != NULL; cur = cur->next)
-    {
-        printf(", ");
-        print_function(cur->data);
-    }
-    puts("]");
+#ifdef __SSE2__
+   return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+   unsigned int mask = 0;
+   for (int i = 0; i < GROUP_WIDTH; i++)
+   {
+      if (ctrl[i] < 0)
+         mask |= 1u << i;
+   }
+   return mask;
+#endif
 }
 
 /**
- * Utility function to print out a hash map with linked list keys
+ * Internal function to allocate the control bytes and buckets of a table with
+ * size slots as the current table of map
  */
-void print_list_map(unsigned int index, int key, void *value)
+static void _allocate_table(hash_map *map, int size)
 {
-    linked_list *temp = (linked_list *) value;
-    printf("Index: %i - (Key:%d, Value:", index, key);
-    print_list(temp, print_lfu_item);
-    printf("\n");
-    
+   map->ctrl = (signed char *)malloc(size);
+   memset(map->ctrl, CTRL_EMPTY, size);
+   map->buckets = (bucket *)malloc(size * sizeof(bucket));
+   map->size = size;
+   // keep the load, tombstones included, at or below 7/8
+   map->growth_left = size - (size >> 3);
 }
 
-//used as a marker for deleted cells
-#define DELETED (void *)-1
-
-//max number of places to look before giving up
-#define MAX_PROBES 20
-
 /**
  * Allocate space for a new hash map
  */
@@ -292,39 +196,60 @@ hash_map *allocate_map(unsigned int capacity,
       num_bits++;
    }
    power_of_2_capacity = 1 << (num_bits + 1);
-
-   // allocate space for hash map struct and the array of pointer to the buckets
-   hash_map *map = malloc(sizeof(hash_map));
-   map->buckets = calloc(power_of_2_capacity, sizeof(bucket *));
+   // the table is probed a whole group at a time
+   if (power_of_2_capacity < GROUP_WIDTH)
+      power_of_2_capacity = GROUP_WIDTH;
+
+   // allocate space for hash map struct, the control bytes and the inline buckets
+   hash_map *map = (hash_map *)malloc(sizeof(hash_map));
+   _allocate_table(map, power_of_2_capacity);
+   map->old_ctrl = NULL;
+   map->old_buckets = NULL;
+   map->old_size = 0;
+   map->migrate_pos = 0;
    map->num_keys = 0;
-   map->size = power_of_2_capacity;
    map->equality_function = equality_function;
    map->hash_function = hash_function;
    map->free_key = free_key;
    map->free_value = free_value;
+   LFU_STAT(memset(map->probes, 0, sizeof(map->probes));)
 
    return map;
 }
 
 /**
- * Free the memory allocated for a hash map. Calls the free_value and free_key 
- * functions passed in on the map creation to properly free the object at the 
- * key and value pointers for each entry.
+ * Internal function to call the free functions on every full slot of a table
  */
-void free_map(hash_map *map)
+static void _free_entries(hash_map *map, signed char *ctrl, bucket *buckets, int size)
 {
-   for (int i = 0; i < map->size; i++)
+   for (int i = 0; i < size; i++)
    {
-      if (map->buckets[i] != NULL && map->buckets[i] != DELETED)
+      if (ctrl[i] >= 0)
       {
          if (map->free_key != NULL)
-            map->free_key(map->buckets[i]->key);
+            map->free_key(buckets[i].key);
          if (map->free_value != NULL)
-            map->free_value(map->buckets[i]->value);
-         free(map->buckets[i]);
+            map->free_value(buckets[i].value);
       }
    }
+}
+
+/**
+ * Free the memory allocated for a hash map. Calls the free_value and free_key 
+ * functions passed in on the map creation to properly free the object at the 
+ * key and value pointers for each entry.
+ */
+void free_map(hash_map *map)
+{
+   _free_entries(map, map->ctrl, map->buckets, map->size);
+   free(map->ctrl);
    free(map->buckets);
+   if (map->old_ctrl != NULL)
+   {
+      _free_entries(map, map->old_ctrl, map->old_buckets, map->old_size);
+      free(map->old_ctrl);
+      free(map->old_buckets);
+   }
    free(map);
 }
 
@@ -332,15 +257,17 @@ void free_map(hash_map *map)
  * Hash an integer to an unsigned int with roughly equal probability that each bit is one
  * important because we do not control the size of the table and thus cannot ensure it is prime
  * (size is actually always a power of 2, not prime)
+ * the low 7 bits pick the control byte and the rest pick the group, so every
+ * bit needs to be mixed
  * source: https://stackoverflow.com/a/12996028
  */
 unsigned int hash_int(int ptr)
 {
    int key = ptr;
    unsigned int x = (unsigned int)key;
-   // x = ((x >> 16) ^ x) * 0x45d9f3b;
-   // x = ((x >> 16) ^ x) * 0x45d9f3b;
-   // x = (x >> 16) ^ x;
+   x = ((x >> 16) ^ x) * 0x45d9f3b;
+   x = ((x >> 16) ^ x) * 0x45d9f3b;
+   x = (x >> 16) ^ x;
    return x;
 }
 
@@ -357,34 +284,189 @@ int equal_int(void *a, void *b)
  */
 void print_lfu_map(unsigned int index, int key, void *value)
 {
-   lfu_item *temp = ((node*)value)->data;
+   lfu_item *temp = (lfu_item *)value;
    printf("Index: %i - (Key: %d, Values: [Key:%d, Value:%d, Freq:%d])\n", index, key, temp->key, temp->value, temp->freq);
 }
 
 /**
- * Internal function to find the index of a key
+ * Internal function to find the index of a key with hash h in a table
+ * Groups are visited in triangular order, which reaches every group once
+ * since the number of groups is a power of 2. With LFU_STATS the number of
+ * groups probed goes in *groups.
  */
-int _find_key(hash_map *map, int key)
+static int _table_find(const signed char *ctrl, const bucket *buckets, int size, int key, unsigned int h
+                       LFU_STAT(, int *groups))
 {
-   unsigned int h = map->hash_function(key);
-   for (int j = 0; j < MAX_PROBES; j++)
+   signed char h2 = (signed char)(h & 0x7f);
+   unsigned int group_mask = size / GROUP_WIDTH - 1;
+   unsigned int group = (h >> 7) & group_mask;
+   for (unsigned int j = 0; j <= group_mask; j++)
    {
-      unsigned int next_index = (h + (j * j) + (23 * j)) & (map->size - 1);
-      if (map->buckets[next_index] == NULL)
+      const signed char *group_ctrl = ctrl + group * GROUP_WIDTH;
+      unsigned int match = _group_match(group_ctrl, h2);
+      while (match != 0)
       {
+         int index = group * GROUP_WIDTH + __builtin_ctz(match);
+         if (buckets[index].key == key)
+         {
+            LFU_STAT(*groups = j + 1;)
+            return index;
+         }
+         match &= match - 1;
+      }
+      // the key would have been placed in an empty slot of this group
+      if (_group_match(group_ctrl, CTRL_EMPTY) != 0)
+      {
+         LFU_STAT(*groups = j + 1;)
          return -1;
       }
-      else if (map->buckets[next_index] == DELETED)
+      group = (group + j + 1) & group_mask;
+   }
+   LFU_STAT(*groups = group_mask + 1;)
+   return -1;
+}
+
+/**
+ * Internal function to place a key that is not in the map into the current
+ * table, reusing the first empty or deleted slot on its probe sequence
+ */
+static void _table_place(hash_map *map, int key, void *value, unsigned int h)
+{
+   unsigned int group_mask = map->size / GROUP_WIDTH - 1;
+   unsigned int group = (h >> 7) & group_mask;
+   unsigned int match;
+   for (unsigned int j = 0; (match = _group_match_free(map->ctrl + group * GROUP_WIDTH)) == 0; j++)
+   {
+      group = (group + j + 1) & group_mask;
+   }
+   int index = group * GROUP_WIDTH + __builtin_ctz(match);
+   if (map->ctrl[index] == CTRL_EMPTY)
+      (map->growth_left)--;
+   map->ctrl[index] = (signed char)(h & 0x7f);
+   map->buckets[index].key = key;
+   map->buckets[index].value = value;
+}
+
+/**
+ * Internal function to free the slot at index of a table. Returns 1 if the slot
+ * could be marked empty rather than left as a tombstone.
+ */
+static int _table_erase(signed char *ctrl, int index)
+{
+   // a search stops at the first group with an empty slot, so if this group
+   // still has one no probe sequence runs through it and no tombstone is needed
+   if (_group_match(ctrl + (index & ~(GROUP_WIDTH - 1)), CTRL_EMPTY) != 0)
+   {
+      ctrl[index] = CTRL_EMPTY;
+      return 1;
+   }
+   ctrl[index] = CTRL_DELETED;
+   return 0;
+}
+
+/**
+ * Internal function to move the next MIGRATE_GROUPS groups of the old table
+ * into the current one, freeing the old table once it has been emptied
+ */
+static void _migrate_step(hash_map *map)
+{
+   for (int g = 0; g < MIGRATE_GROUPS && map->old_ctrl != NULL; g++)
+   {
+      int end = map->migrate_pos + GROUP_WIDTH;
+      for (int i = map->migrate_pos; i < end; i++)
       {
-         continue;
+         if (map->old_ctrl[i] >= 0)
+         {
+            int key = map->old_buckets[i].key;
+            _table_place(map, key, map->old_buckets[i].value, map->hash_function(key));
+            // lookups for keys further on still have to probe past this slot
+            map->old_ctrl[i] = CTRL_DELETED;
+         }
       }
-      else if (map->hash_function(map->buckets[next_index]->key) == h &&
-               map->buckets[next_index]->key == key)
+      map->migrate_pos = end;
+      if (map->migrate_pos == map->old_size)
       {
-         return next_index;
+         free(map->old_ctrl);
+         free(map->old_buckets);
+         map->old_ctrl = NULL;
+         map->old_buckets = NULL;
+         map->old_size = 0;
       }
    }
-   return -1;
+}
+
+/**
+ * Internal function to start moving into a fresh table once the current one has
+ * run out of empty slots. The table doubles if at least half of the used slots
+ * hold keys, otherwise the new table has the same size and just drops the
+ * tombstones. Entries are then moved over a few groups per operation by
+ * _migrate_step instead of all at once.
+ */
+static void _start_resize(hash_map *map)
+{
+   // a resize starts with at most 7/8 of the old table in the new one and
+   // finishes within old_size / (GROUP_WIDTH * MIGRATE_GROUPS) operations, so
+   // the new table cannot fill up first and this loop never runs in practice
+   while (map->old_ctrl != NULL)
+      _migrate_step(map);
+
+   int new_size = (long long)map->num_keys * 16 >= (long long)map->size * 7 ? map->size * 2 : map->size;
+   map->old_ctrl = map->ctrl;
+   map->old_buckets = map->buckets;
+   map->old_size = map->size;
+   map->migrate_pos = 0;
+   _allocate_table(map, new_size);
+}
+
+/**
+ * Internal function to find the slot of a key, in the current table or in the old
+ * one while a resize is in progress. Returns the index or -1, and sets *in_old.
+ * With LFU_STATS the number of groups probed in both tables is stored in *groups.
+ */
+static int _find_key(hash_map *map, int key, unsigned int h, int *in_old
+                     LFU_STAT(, int *groups))
+{
+   LFU_STAT(int old_groups = 0;)
+   int index = _table_find(map->ctrl, map->buckets, map->size, key, h LFU_STAT(, groups));
+   *in_old = 0;
+   if (index == -1 && map->old_ctrl != NULL)
+   {
+      index = _table_find(map->old_ctrl, map->old_buckets, map->old_size, key, h LFU_STAT(, &old_groups));
+      *in_old = 1;
+   }
+   LFU_STAT(*groups += old_groups;)
+   return index;
+}
+
+/**
+ * Internal function returning the bucket holding key, or NULL. Only these
+ * lookups, which the cache's get and put make, have their probe lengths
+ * counted, not the ones inside map_insert and map_delete.
+ */
+static bucket *_find_bucket(hash_map *map, int key)
+{
+   if (map->old_ctrl != NULL)
+      _migrate_step(map);
+
+   int in_old;
+   LFU_STAT(int groups;)
+   int index = _find_key(map, key, map->hash_function(key), &in_old LFU_STAT(, &groups));
+   LFU_STAT(map->probes[_lfu_stats_bucket(groups)]++;)
+   if (index == -1)
+      return NULL;
+   return in_old ? &map->old_buckets[index] : &map->buckets[index];
+}
+
+/**
+ * Start pulling the first group a lookup of key would probe into cache, so
+ * that several lookups can wait on memory at once
+ */
+void map_prefetch(hash_map *map, int key)
+{
+   unsigned int h = map->hash_function(key);
+   unsigned int group = (h >> 7) & (map->size / GROUP_WIDTH - 1);
+   __builtin_prefetch(map->ctrl + group * GROUP_WIDTH);
+   __builtin_prefetch(map->buckets + group * GROUP_WIDTH);
 }
 
 /**
@@ -392,7 +474,7 @@ int _find_key(hash_map *map, int key)
  */
 int map_contains(hash_map *map, int key)
 {
-   return _find_key(map, key) == -1 ? 0 : 1;
+   return _find_bucket(map, key) == NULL ? 0 : 1;
 }
 
 /**
@@ -401,8 +483,8 @@ int map_contains(hash_map *map, int key)
  */
 void *map_get(hash_map *map, int key)
 {
-   int index = _find_key(map, key);
-   return index == -1 ? NULL : map->buckets[index]->value;
+   bucket *b = _find_bucket(map, key);
+   return b == NULL ? NULL : b->value;
 }
 
 /**
@@ -412,54 +494,49 @@ void *map_get(hash_map *map, int key)
  */
 int map_update(hash_map *map, int key, void *value)
 {
-   int index = _find_key(map, key);
+   bucket *b = _find_bucket(map, key);
 
-   if (index == -1)
+   if (b == NULL)
    {
       return 0;
    }
 
-   if (key != map->buckets[index]->key)
-      map->free_key(map->buckets[index]->key);
-   if (value != map->buckets[index]->value)
-      map->free_value(map->buckets[index]->value);
+   if (key != b->key && map->free_key != NULL)
+      map->free_key(b->key);
+   if (value != b->value && map->free_value != NULL)
+      map->free_value(b->value);
 
-   map->buckets[index]->key = key;
-   map->buckets[index]->value = value;
+   b->key = key;
+   b->value = value;
 
    return 1;
 }
 
 /**
- *  Inserts a key into the hash table. Returns 0 if unsuccessful, and 1 if successful.
+ *  Inserts a key into the hash table. Returns 0 if the key is already present,
+ *  and 1 if successful. The table grows as needed, so inserts do not fail.
  *  Postcondition: the memory pointed at by key and value is never freed before the 
  *  pair is removed from the hash set (i.e. be careful with stack variables)
  */
 int map_insert(hash_map *map, int key, void *value)
 {
-   if (map_contains(map, key))
-   {
-      return 0;
-   }
+   if (map->old_ctrl != NULL)
+      _migrate_step(map);
 
    unsigned int h = map->hash_function(key);
-
-   for (int j = 0; j < MAX_PROBES; j++)
+   int in_old;
+   LFU_STAT(int groups;)
+   if (_find_key(map, key, h, &in_old LFU_STAT(, &groups)) != -1)
    {
-      unsigned int next_index = (h + (j * j) + (23 * j)) & (map->size - 1);
-      if (map->buckets[next_index] == NULL || map->buckets[next_index] == DELETED)
-      {
-         bucket *elem = malloc(sizeof(bucket));
-         elem->key = key;
-         elem->value = value;
-
-         map->buckets[next_index] = elem;
-         (map->num_keys)++;
-         return 1;
-      }
+      return 0;
    }
 
-   return 0;
+   if (map->growth_left == 0)
+      _start_resize(map);
+
+   _table_place(map, key, value, h);
+   (map->num_keys)++;
+   return 1;
 }
 
 /**
@@ -469,40 +546,61 @@ int map_insert(hash_map *map, int key, void *value)
  */
 int map_delete(hash_map *map, int key)
 {
-   int index = _find_key(map, key);
+   if (map->old_ctrl != NULL)
+      _migrate_step(map);
+
+   int in_old;
+   LFU_STAT(int groups;)
+   int index = _find_key(map, key, map->hash_function(key), &in_old LFU_STAT(, &groups));
 
    if (index == -1)
    {
       return 0;
    }
 
+   bucket *b = in_old ? &map->old_buckets[index] : &map->buckets[index];
    if (map->free_key != NULL)
-      map->free_key(map->buckets[index]->key);
+      map->free_key(b->key);
    if (map->free_value != NULL)
-      map->free_value(map->buckets[index]->value);
-   free(map->buckets[index]);
+      map->free_value(b->value);
 
-   map->buckets[index] = DELETED;
+   if (in_old)
+      _table_erase(map->old_ctrl, index);
+   else if (_table_erase(map->ctrl, index))
+      (map->growth_left)++;
    (map->num_keys)--;
 
    return 1;
 }
 
 /**
- *  Prints out the hash table. 
+ * Internal function to print every full slot of a table
  */
-void print_map(hash_map *map)
+static void _print_table(const signed char *ctrl, const bucket *buckets, int size, void (*print_function)(unsigned int index, int key, void *value))
 {
-   printf("Size: %i\n", map->num_keys);
-   for (int i = 0; i < map->size; i++)
+   for (int i = 0; i < size; i++)
    {
-      if (map->buckets[i] != NULL && map->buckets[i] != DELETED)
+      if (ctrl[i] >= 0)
       {
-         printf("%i: (%i, %p)\n", i, map->buckets[i]->key, map->buckets[i]->value);
+         if (print_function == NULL)
+            printf("%i: (%i, %p)\n", i, buckets[i].key, buckets[i].value);
+         else
+            print_function(i, buckets[i].key, buckets[i].value);
       }
    }
 }
 
+/**
+ *  Prints out the hash table. 
+ */
+void print_map(hash_map *map)
+{
+   printf("Size: %i\n", map->num_keys);
+   _print_table(map->ctrl, map->buckets, map->size, NULL);
+   if (map->old_ctrl != NULL)
+      _print_table(map->old_ctrl, map->old_buckets, map->old_size, NULL);
+}
+
 /**
  *  Prints out the hash table, using the supplied function to print each 
  *  key value pair.
@@ -510,21 +608,76 @@ void print_map(hash_map *map)
 void pretty_print_map(hash_map *map, void (*print_function)(unsigned int index, int key, void *value))
 {
    printf("Pretty print - Size: %i\n", map->num_keys);
-   for (int i = 0; i < map->size; i++)
-   {
-      if (map->buckets[i] != NULL && map->buckets[i] != DELETED)
-      {
-         print_function(i, map->buckets[i]->key, map->buckets[i]->value);
-      }
-   }
+   _print_table(map->ctrl, map->buckets, map->size, print_function);
+   if (map->old_ctrl != NULL)
+      _print_table(map->old_ctrl, map->old_buckets, map->old_size, print_function);
 }
 
 /**
- * Utility function to free a linked list node that has an lfu_item struct as its data
+ * Take a frequency node for freq from the preallocated pool and link it in
+ * between prev and next
  */
-void free_item_node(void *ptr)
+freq_node *create_freq_node(LFUCache *obj, int freq, freq_node *prev, freq_node *next)
+{
+    freq_node *fn = obj->free_freq;
+    obj->free_freq = fn->next;
+    fn->freq = freq;
+    fn->head = fn->tail = NULL;
+    fn->prev = prev;
+    fn->next = next;
+    if (prev != NULL)
+        prev->next = fn;
+    else
+        obj->freq_head = fn;
+    if (next != NULL)
+        next->prev = fn;
+    return fn;
+}
+
+/**
+ * Unlink an empty frequency node from the frequency list and return it to the pool
+ */
+void free_freq_node(LFUCache *obj, freq_node *fn)
+{
+    if (fn->prev != NULL)
+        fn->prev->next = fn->next;
+    else
+        obj->freq_head = fn->next;
+    if (fn->next != NULL)
+        fn->next->prev = fn->prev;
+    fn->next = obj->free_freq;
+    obj->free_freq = fn;
+}
+
+/**
+ * Pushes item onto the back (most recently used end) of the list of fn
+ */
+void freq_push_back(freq_node *fn, lfu_item *item)
+{
+    item->parent = fn;
+    item->next = NULL;
+    item->prev = fn->tail;
+    if (fn->tail == NULL)
+        fn->head = item;
+    else
+        fn->tail->next = item;
+    fn->tail = item;
+}
+
+/**
+ * Unlinks item from the list of its frequency node
+ */
+void freq_remove(lfu_item *item)
 {
-    free_node((node *)ptr, free);
+    freq_node *fn = item->parent;
+    if (item->prev == NULL)
+        fn->head = item->next;
+    else
+        item->prev->next = item->next;
+    if (item->next == NULL)
+        fn->tail = item->prev;
+    else
+        item->next->prev = item->prev;
 }
 
 /** 
@@ -537,28 +690,75 @@ LFUCache *lFUCacheCreate(int capacity)
     // ensures that load rate never goes above 66%
     int size = capacity + (capacity >> 1);
 
-    LFUCache *obj = malloc(sizeof(LFUCache));
+    LFUCache *obj = (LFUCache *)malloc(sizeof(LFUCache));
 
-    // allocate the freq -> linked list map
-    // * note that deleting a key from the freq map only frees the linked list
-    // * struct itself, and not the actual nodes of the list
-    // * since the lfu cache never deletes keys from the freq list and just leaves
-    // * the linked lists empty if there are no nodes of that frequency, this is not a problem
-    obj->freq_map = allocate_map(size, hash_int, equal_int, NULL, free);
-    // allocate the item key -> linked list node map
-    obj->item_map = allocate_map(size, hash_int, equal_int, NULL, free_item_node);
+    // allocate the item key -> item map, the items themselves live in obj->items
+    obj->item_map = allocate_map(size, hash_int, equal_int, NULL, NULL);
+    obj->items = (lfu_item *)malloc(capacity * sizeof(lfu_item));
+    // there is never more than one frequency node per item, plus one while an
+    // item moves up to a new frequency
+    obj->freq_nodes = (freq_node *)malloc((capacity + 1) * sizeof(freq_node));
+    obj->free_freq = NULL;
+    for (int i = capacity; i >= 0; i--)
+    {
+        obj->freq_nodes[i].next = obj->free_freq;
+        obj->free_freq = &obj->freq_nodes[i];
+    }
+    // the frequency list starts out empty, its head is always the lowest frequency
+    obj->freq_head = NULL;
     // initialize sizes
     obj->size = 0;
-    obj->min_freq = 1;
     obj->capacity = capacity;
-
-    // ensure the list at freq 1 is not null, useful so no checking
-    // is required when inserting
-    map_insert(obj->freq_map, 1, create_linked_list());
+    // no aging unless lFUCacheSetAging turns it on
+    obj->age = 0;
+    obj->aging = 0;
+    LFU_STAT(memset(&obj->stats, 0, sizeof(obj->stats));)
 
     return obj;
 }
 
+/**
+ * Turn LFU with dynamic aging on or off for the cache at obj pointer.  With
+ * aging on, new items start one above the frequency of the last evicted item,
+ * so items that were hot long ago are eventually evicted by newer ones.
+ */
+void lFUCacheSetAging(LFUCache *obj, int enabled)
+{
+    obj->aging = enabled;
+    if (!enabled)
+        obj->age = 0;
+}
+
+/**
+ * Internal function to move an item up to the list for the next frequency,
+ * creating that list if needed and dropping the old one once empty
+ */
+void lFUCacheTouch(LFUCache *obj, lfu_item *item)
+{
+    freq_node *cur = item->parent;
+    freq_node *next = cur->next;
+
+    item->freq++;
+    if (next == NULL || next->freq != item->freq)
+    {
+        // the item is alone in its list, so the list can just be renumbered
+        if (cur->head == cur->tail)
+        {
+            cur->freq++;
+            return;
+        }
+        next = create_freq_node(obj, item->freq, cur, cur->next);
+    }
+
+    freq_remove(item);
+    freq_push_back(next, item);
+
+    if (cur->head == NULL)
+    {
+        free_freq_node(obj, cur);
+    }
+}
+
 /**
  * Returns the value associated with the integer key and updates it frequency, 
  * increasing it by one.
@@ -569,59 +769,85 @@ int lFUCacheGet(LFUCache *obj, int key)
         return -1;
     }
 
-    node *temp;
-    if((temp = (node *)map_get(obj->item_map, key)) == NULL) {
+    lfu_item *temp;
+    if((temp = (lfu_item *)map_get(obj->item_map, key)) == NULL) {
+        LFU_STAT(obj->stats.misses++;)
         return -1;
     }
 
-    pop_node(map_get(obj->freq_map, ((lfu_item *)temp->data)->freq), temp);
-    if(is_empty(map_get(obj->freq_map, ((lfu_item *)temp->data)->freq))) {
-        map_delete(obj->freq_map, ((lfu_item *)temp->data)->freq);
-    }
-    
+    LFU_STAT(obj->stats.hits++;)
+    lFUCacheTouch(obj, temp);
 
-    ((lfu_item *)temp->data)->freq++;
-
-    linked_list *update;
-    if((update = map_get(obj->freq_map, ((lfu_item *)temp->data)->freq)) == NULL) {
-        update = create_linked_list();
-        push_back(update, temp);
-        map_insert(obj->freq_map, ((lfu_item *)temp->data)->freq, update);
-    } else {
-        push_back(update, temp);
-    }
+    return temp->value;
+}
 
-    while(1) {
-        if(map_contains(obj->freq_map, obj->min_freq)) {
-            if(((linked_list*)map_get(obj->freq_map, obj->min_freq))->num_nodes == 0) {
-                obj->min_freq++;
-            } else {
-                break;
-            }
-        } else {
-            obj->min_freq++;
-        }
+/**
+ * Internal function to evict the least frequently used member of the cache.
+ * Returns the evicted item so its slot can be reused.
+ */
+lfu_item *lFUCacheEvict(LFUCache *obj)
+{
+    // remove the least recently used item from the lowest frequency list
+    freq_node *min_freq_list = obj->freq_head;
+    lfu_item *removed_item = min_freq_list->head;
+    LFU_STAT(obj->stats.evictions++;)
+    if (obj->aging)
+        obj->age = removed_item->freq;
+    freq_remove(removed_item);
+    if (min_freq_list->head == NULL)
+    {
+        free_freq_node(obj, min_freq_list);
     }
 
-    // while(!map_contains(obj->freq_map, &obj->min_freq) || ((linked_list*)map_get(obj->freq_map, &obj->min_freq))->num_nodes == 0) {
-    //     obj->min_freq++;
-    // }
-    return ((lfu_item *)temp->data)->value;
+    // remove the item from the item map
+    map_delete(obj->item_map, removed_item->key);
+    obj->size--;
+    return removed_item;
 }
 
 /**
- * Internal function to evict the least frequently used member of the cache
+ * Internal function to put key and value into the cache, given the item the map
+ * holds for key or NULL, so callers that already looked key up do not repeat it.
  */
-void lFUCacheEvict(LFUCache *obj)
+void lFUCacheSet(LFUCache *obj, lfu_item *old_item, int key, int value)
 {
-    // remove the node from the min_freq linked list
-    linked_list *min_freq_list = map_get(obj->freq_map, obj->min_freq);
-    node *removed_node = pop_front(min_freq_list);
+    if (old_item != NULL)
+    {
+        LFU_STAT(obj->stats.updates++;)
+        update_lfu_item(old_item, key, value);
+        lFUCacheTouch(obj, old_item);
+        return;
+    }
 
-    // remove the node from the item map
-    // this call also frees the node as well
-    map_delete(obj->item_map, ((lfu_item *)removed_node->data)->key);
-    obj->size--;
+    LFU_STAT(obj->stats.inserts++;)
+
+    // take the next unused slot, or reuse the slot of the evicted item
+    lfu_item *new_item;
+    if (obj->size == obj->capacity)
+        new_item = lFUCacheEvict(obj);
+    else
+        new_item = &obj->items[obj->size];
+    update_lfu_item(new_item, key, value);
+    new_item->freq = obj->age + 1;
+
+    // new items go in the age + 1 list, every item has at least age uses so
+    // that is the head or the list right after it
+    freq_node *prev = NULL;
+    freq_node *fn = obj->freq_head;
+    if (fn != NULL && fn->freq < new_item->freq)
+    {
+        prev = fn;
+        fn = fn->next;
+    }
+    if (fn == NULL || fn->freq != new_item->freq)
+    {
+        fn = create_freq_node(obj, new_item->freq, prev, fn);
+    }
+    freq_push_back(fn, new_item);
+
+    map_insert(obj->item_map, key, new_item);
+
+    obj->size++;
 }
 
 /**
@@ -635,36 +861,132 @@ void lFUCachePut(LFUCache *obj, int key, int value)
         return;
     }
 
-    node *old_node = map_get(obj->item_map, key);
-    if (old_node != NULL)
+    lFUCacheSet(obj, (lfu_item *)map_get(obj->item_map, key), key, value);
+}
+
+//number of keys whose memory is prefetched together by the batch functions,
+//enough to cover memory latency without the prefetched lines being evicted
+#define PREFETCH_GROUP 16
+
+/**
+ * Get the values for n keys into out, -1 for a miss, counting uses exactly as
+ * n calls to lFUCacheGet would. Keys are taken in groups whose map groups,
+ * items and frequency nodes are all prefetched before any use is counted, so
+ * the cache misses of a group overlap instead of each lookup waiting on its own.
+ */
+void lFUCacheGetBatch(LFUCache *obj, const int *keys, int n, int *out)
+{
+    lfu_item *items[PREFETCH_GROUP];
+    for (int base = 0; base < n; base += PREFETCH_GROUP)
     {
-        update_lfu_item((lfu_item *)old_node->data, key, value);
-        lFUCacheGet(obj, key);
-        return;
+        int m = n - base < PREFETCH_GROUP ? n - base : PREFETCH_GROUP;
+        if (obj->capacity == 0)
+        {
+            for (int i = 0; i < m; i++)
+                out[base + i] = -1;
+            continue;
+        }
+        for (int i = 0; i < m; i++)
+            map_prefetch(obj->item_map, keys[base + i]);
+        for (int i = 0; i < m; i++)
+        {
+            items[i] = (lfu_item *)map_get(obj->item_map, keys[base + i]);
+            if (items[i] != NULL)
+                __builtin_prefetch(items[i]);
+        }
+        for (int i = 0; i < m; i++)
+        {
+            if (items[i] != NULL)
+                __builtin_prefetch(items[i]->parent);
+        }
+        // counting uses never moves items, so the lookups above stay valid
+        for (int i = 0; i < m; i++)
+        {
+            if (items[i] == NULL)
+            {
+                LFU_STAT(obj->stats.misses++;)
+                out[base + i] = -1;
+                continue;
+            }
+            LFU_STAT(obj->stats.hits++;)
+            lFUCacheTouch(obj, items[i]);
+            out[base + i] = items[i]->value;
+        }
     }
+}
 
-    lfu_item *new_item = create_lfu_item(key, value);
-    if (obj->size == obj->capacity)
+/**
+ * Put n key value pairs into the cache in order, as n calls to lFUCachePut
+ * would, prefetching the map groups and items of each group of keys first. Each
+ * key is looked up once, in the prefetch pass, unless it repeats within its
+ * group.
+ */
+void lFUCachePutBatch(LFUCache *obj, const int *keys, const int *values, int n)
+{
+    lfu_item *items[PREFETCH_GROUP];
+    if (obj->capacity == 0)
+        return;
+    for (int base = 0; base < n; base += PREFETCH_GROUP)
     {
-        lFUCacheEvict(obj);
+        int m = n - base < PREFETCH_GROUP ? n - base : PREFETCH_GROUP;
+        for (int i = 0; i < m; i++)
+            map_prefetch(obj->item_map, keys[base + i]);
+        for (int i = 0; i < m; i++)
+        {
+            items[i] = (lfu_item *)map_get(obj->item_map, keys[base + i]);
+            if (items[i] != NULL)
+                __builtin_prefetch(items[i]);
+        }
+        for (int i = 0; i < m; i++)
+        {
+            int key = keys[base + i];
+            lfu_item *item = items[i];
+            // an earlier put of the group may have evicted key, reusing its
+            // item for another key, and only an earlier put of key itself can
+            // have put it back, so only then is key looked up again
+            if (item != NULL && item->key != key)
+                item = NULL;
+            int again = 0;
+            for (int j = 0; j < i && !again; j++)
+                again = keys[base + j] == key;
+            if (again)
+                item = (lfu_item *)map_get(obj->item_map, key);
+            lFUCacheSet(obj, item, key, values[base + i]);
+        }
     }
+}
 
-    node *new_node = create_node(new_item);
-
-    // need to check for nullptr now since we are deleting linked
-    //lists in freq_map as we go
-    linked_list *freq_list;
-    if ((freq_list = map_get(obj->freq_map, new_item->freq)) == NULL) {
-        freq_list = create_linked_list();
-        map_insert(obj->freq_map, 1, freq_list);
+#ifdef LFU_STATS
+/**
+ * Copy the counters of the cache at obj pointer into out, along with the probe
+ * lengths of its map and the current sizes of its frequency lists.
+ */
+void lFUCacheStats(LFUCache *obj, lfu_stats *out)
+{
+    *out = obj->stats;
+    memcpy(out->probes, obj->item_map->probes, sizeof(out->probes));
+    for (freq_node *fn = obj->freq_head; fn != NULL; fn = fn->next)
+    {
+        unsigned long long n = 0;
+        for (lfu_item *item = fn->head; item != NULL; item = item->next)
+            n++;
+        out->list_sizes[_lfu_stats_bucket(n)]++;
     }
-    
-    push_back(freq_list, new_node);
-
-    map_insert(obj->item_map, new_item->key, new_node);
+}
+#endif
 
-    obj->size++;
-    obj->min_freq = 1;
+/**
+ * Returns the number of heap bytes held by the cache at obj pointer.
+ */
+size_t lFUCacheBytes(LFUCache *obj)
+{
+    hash_map *map = obj->item_map;
+    size_t bytes = sizeof(LFUCache) + sizeof(hash_map);
+    bytes += map->size * (sizeof(signed char) + sizeof(bucket));
+    bytes += map->old_size * (sizeof(signed char) + sizeof(bucket));
+    bytes += obj->capacity * sizeof(lfu_item);
+    bytes += (obj->capacity + 1) * sizeof(freq_node);
+    return bytes;
 }
 
 /**
@@ -672,10 +994,10 @@ void lFUCachePut(LFUCache *obj, int key, int value)
  */
 void lFUCacheFree(LFUCache *obj)
 {
-    // free the item map and the associated nodes
+    // the map, the items and the frequency nodes are each a single allocation
     free_map(obj->item_map);
-    // now free the freq map and the now empty linked list structs
-    free_map(obj->freq_map);
+    free(obj->items);
+    free(obj->freq_nodes);
     // free the lfu struct itself
     free(obj);
 }
\ No newline at end of file
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Open addressing hash -> T map with linear probing. Entries live inline in
+// one power of 2 sized array that is allocated once from the expected number
+// of keys, and deletes shift the following run back instead of leaving
+// tombstones, so probe runs stay short however much the keys churn.
+//
+// The index only stores each key's hash. Callers pass the hash in along with
+// a predicate that recognises their key in an entry, so keys can live in the
+// nodes the entries point at.
+template <typename T, typename Alloc = std::allocator<T>>
+class FlatIndex {
+    public:
+        struct Slot {
+            // Mixed hash with the low bit set, so 0 marks an empty slot
+            std::size_t hash;
+            T val;
+        };
+
+    private:
+        std::vector<Slot, typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>> slots;
+
+        std::size_t mask;
+        int shift;
+        std::size_t count;
+
+        // Fibonacci hashing, multiplying by 2^64 / phi spreads every bit of
+        // the caller's hash into the top bits, which pick the home slot
+        static std::size_t mix(std::size_t hash) {
+            return (std::size_t)((uint64_t)hash * 11400714819323198485ull) | 1;
+        }
+
+        std::size_t home(std::size_t mixed) const {
+            return mixed >> shift;
+        }
+
+    public:
+        // Keeps the load factor at or below 1/2 for up to maxkeys keys
+        explicit FlatIndex(int maxkeys, const Alloc& alloc = Alloc()) : slots(alloc), count(0) {
+            int bits = 1;
+            while (maxkeys > 0 and ((std::size_t)1 << bits) < (std::size_t)maxkeys * 2)
+                bits++;
+            slots.resize((std::size_t)1 << bits);
+            mask = slots.size() - 1;
+            shift = 64 - bits;
+        }
+
+        std::size_t size(void) const {
+            return count;
+        }
+
+        std::size_t bytes(void) const {
+            return slots.size() * sizeof(Slot);
+        }
+
+        // Returns the slot whose entry matches, or nullptr
+        template <typename Match>
+        Slot* find(std::size_t hash, Match match) {
+            hash = mix(hash);
+            for (std::size_t i = home(hash);; i = (i + 1) & mask) {
+                Slot& s = slots[i];
+                if (s.hash == 0)
+                    return nullptr;
+                if (s.hash == hash and match(s.val))
+                    return &s;
+            }
+        }
+
+        // Slots a find() of hash looked at, given the slot it returned
+        std::size_t probes(std::size_t hash, const Slot* found) const {
+            std::size_t i = home(mix(hash));
+            if (found != nullptr)
+                return ((found - slots.data() - i) & mask) + 1;
+            std::size_t n = 1;
+            for (; slots[i].hash != 0; i = (i + 1) & mask)
+                n++;
+            return n;
+        }
+
+        // Starts pulling hash's home slot into cache, for callers that look
+        // up several keys at once
+        void prefetch(std::size_t hash) const {
+            __builtin_prefetch(&slots[home(mix(hash))]);
+        }
+
+        // find() for readers racing a writer under a seqlock. Slot hashes are
+        // read with relaxed atomic loads and the probe gives up after one lap,
+        // so a torn view only produces an answer the caller will discard.
+        template <typename Match>
+        const Slot* peek(std::size_t hash, Match match) const {
+            hash = mix(hash);
+            std::size_t i = home(hash);
+            for (std::size_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+                std::size_t h = __atomic_load_n(&slots[i].hash, __ATOMIC_RELAXED);
+                if (h == 0)
+                    return nullptr;
+                if (h == hash and match(slots[i].val))
+                    return &slots[i];
+            }
+            return nullptr;
+        }
+
+        // Claims a slot for a key that is not already present and returns it
+        // for the caller to fill in
+        Slot* insert(std::size_t hash) {
+            hash = mix(hash);
+            std::size_t i = home(hash);
+            while (slots[i].hash != 0)
+                i = (i + 1) & mask;
+            slots[i].hash = hash;
+            count++;
+            return &slots[i];
+        }
+
+        // Frees slot and pulls later members of its run back into the hole.
+        // Invalidates any other Slot pointers.
+        void erase(Slot* slot) {
+            std::size_t hole = slot - slots.data();
+            for (std::size_t i = (hole + 1) & mask; slots[i].hash != 0; i = (i + 1) & mask) {
+                // An entry can fill the hole unless its home lies cyclically
+                // in (hole, i]
+                std::size_t h = home(slots[i].hash);
+                if (((i - h) & mask) >= ((i - hole) & mask)) {
+                    slots[hole] = slots[i];
+                    hole = i;
+                }
+            }
+            slots[hole].hash = 0;
+            count--;
+        }
+};
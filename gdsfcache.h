@@ -0,0 +1,255 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "nodepool.h"
+#include "flatindex.h"
+
+// GreedyDual-Size-Frequency cache. Every entry carries the cost of fetching
+// it again and its size, and its priority is clock + uses * cost / size, so
+// entries that are cheap to refetch and take a lot of room go first. Priorities
+// sit in a binary min-heap and each eviction raises the clock to the evicted
+// priority, which ages everything left behind without touching it.
+//
+// The cache holds at most capacity entries whose sizes sum to at most budget.
+// With a cost of 1 it keeps many small entries and maximises hit ratio, with
+// cost equal to size it maximises byte hit ratio, and with the real cost of a
+// miss it minimises backend load. put without cost and size uses 1 for both.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class GDSFCache {
+    private:
+        struct Node {
+            Key key;
+            Value val;
+            double priority;
+            double cost;
+            uint64_t size;
+            uint32_t uses;
+            // Position in the heap
+            uint32_t pos;
+
+            template <typename K, typename V>
+            Node(K&& key, V&& val, double cost, uint64_t size, uint32_t uses)
+                : key(std::forward<K>(key)), val(std::forward<V>(val)),
+                  priority(0), cost(cost), size(size), uses(uses), pos(0) {}
+        };
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        using Slot = typename FlatIndex<Node*, Rebind<Node*>>::Slot;
+
+        FlatIndex<Node*, Rebind<Node*>> index;
+        std::vector<Node*, Rebind<Node*>> heap;
+
+        // Priority of the last eviction
+        double clock;
+
+        uint64_t budget;
+        uint64_t used;
+
+        int maxcap;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        NodePool<Node, Rebind<Node>> pool;
+
+        template <typename K>
+        Slot* lookup(const K& key, std::size_t hash) {
+            return index.find(hash, [&](Node* n) { return equal(n->key, key); });
+        }
+
+        void place(Node* n, uint32_t pos) {
+            heap[pos] = n;
+            n->pos = pos;
+        }
+
+        void siftUp(Node* n) {
+            uint32_t pos = n->pos;
+            while (pos > 0) {
+                uint32_t parent = (pos - 1) / 2;
+                if (heap[parent]->priority <= n->priority)
+                    break;
+                place(heap[parent], pos);
+                pos = parent;
+            }
+            place(n, pos);
+        }
+
+        void siftDown(Node* n) {
+            uint32_t pos = n->pos;
+            uint32_t count = heap.size();
+            for (;;) {
+                uint32_t child = 2 * pos + 1;
+                if (child >= count)
+                    break;
+                if (child + 1 < count and heap[child + 1]->priority < heap[child]->priority)
+                    child++;
+                if (n->priority <= heap[child]->priority)
+                    break;
+                place(heap[child], pos);
+                pos = child;
+            }
+            place(n, pos);
+        }
+
+        // Takes n out of the heap, the index and the budget
+        void remove(Slot* slot) {
+            Node* n = slot->val;
+            index.erase(slot);
+            used -= n->size;
+            Node* last = heap.back();
+            heap.pop_back();
+            if (last != n) {
+                place(last, n->pos);
+                if (last->priority < n->priority)
+                    siftUp(last);
+                else
+                    siftDown(last);
+            }
+        }
+
+        // Counts a use and moves n to its new priority, which is lower only
+        // if its cost went down
+        void touch(Node* n) {
+            double old = n->priority;
+            n->uses++;
+            n->priority = clock + n->uses * n->cost / n->size;
+            if (n->priority < old)
+                siftUp(n);
+            else
+                siftDown(n);
+        }
+
+        // Evicts the lowest priority until size more fits
+        void makeRoom(uint64_t size) {
+            while (not heap.empty() and (heap.size() >= (std::size_t)maxcap or used + size > budget)) {
+                Node* n = heap.front();
+                clock = n->priority;
+                remove(lookup(n->key, hasher(n->key)));
+                pool.destroy(n);
+            }
+        }
+
+    public:
+        // budget defaults to capacity, so that with unit sizes capacity alone
+        // bounds the cache
+        GDSFCache(int capacity, uint64_t budget = 0,
+                  const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                  const Alloc& alloc = Alloc())
+            : index(capacity, Rebind<Node*>(alloc)), heap(Rebind<Node*>(alloc)), clock(0),
+              budget(budget > 0 or capacity <= 0 ? budget : capacity), used(0), maxcap(capacity),
+              hasher(hasher), equal(equal),
+              pool(capacity > 0 ? capacity : 0, true, Rebind<Node>(alloc)) {
+            if (capacity > 0)
+                heap.reserve(capacity);
+        }
+
+        GDSFCache(const GDSFCache&) = delete;
+        GDSFCache& operator=(const GDSFCache&) = delete;
+
+        ~GDSFCache(void) {
+            for (Node* n : heap)
+                pool.destroy(n);
+        }
+
+        // Returns the cached value after counting a use, or nullptr. The
+        // pointer stays valid until key is evicted or extracted.
+        template <typename K>
+        Value* get(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return nullptr;
+            Node* n = slot->val;
+            touch(n);
+            return &n->val;
+        }
+
+        // Returns the cached value without counting a use, or nullptr
+        template <typename K>
+        Value* peek(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            return slot != nullptr ? &slot->val->val : nullptr;
+        }
+
+        // Inserts or overwrites the value for key, counting a use. A value
+        // bigger than the whole budget is not cached, and drops any older
+        // value for key.
+        template <typename K, typename V>
+        void put(K&& key, V&& val, double cost, uint64_t size) {
+            if (maxcap <= 0)
+                return;
+            if (size == 0)
+                size = 1;
+            std::size_t hash = hasher(key);
+            Slot* slot = lookup(key, hash);
+            uint32_t uses = 0;
+            if (slot != nullptr) {
+                Node* n = slot->val;
+                // Same size, update in place
+                if (n->size == size) {
+                    n->val = std::forward<V>(val);
+                    n->cost = cost;
+                    touch(n);
+                    return;
+                }
+                uses = n->uses;
+                remove(slot);
+                pool.destroy(n);
+            }
+            if (size > budget)
+                return;
+            makeRoom(size);
+            Node* n = pool.create(std::forward<K>(key), std::forward<V>(val), cost, size, uses + 1);
+            n->priority = clock + n->uses * cost / size;
+            used += size;
+            n->pos = heap.size();
+            heap.push_back(n);
+            siftUp(n);
+            index.insert(hash)->val = n;
+        }
+
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            put(std::forward<K>(key), std::forward<V>(val), 1.0, 1);
+        }
+
+        // Removes key and moves its value out, if present
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return std::nullopt;
+            Node* n = slot->val;
+            remove(slot);
+            std::optional<Value> val (std::move(n->val));
+            pool.destroy(n);
+            return val;
+        }
+
+        std::size_t size(void) const {
+            return heap.size();
+        }
+
+        // Sum of the sizes of the cached entries
+        uint64_t usedBytes(void) const {
+            return used;
+        }
+
+        int capacity(void) const {
+            return maxcap;
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) + index.bytes() + heap.capacity() * sizeof(Node*) + pool.bytes();
+        }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cheapest clock available, the TSC where there is one. Ticks are converted
+// to nanoseconds with a rate measured over each run.
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Log-linear histogram, 16 buckets per power of 2, so any recorded value is
+// off by at most 1/16 and recording is a count leading zeros and an add
+class Histogram {
+    private:
+        static constexpr int subbits = 4;
+
+        uint64_t counts[(64 - subbits + 1) << subbits];
+        uint64_t total;
+
+        static std::size_t bucket(uint64_t v) {
+            if (v < (1u << subbits))
+                return v;
+            int e = 63 - __builtin_clzll(v);
+            return ((std::size_t)(e - subbits + 1) << subbits) | ((v >> (e - subbits)) & ((1u << subbits) - 1));
+        }
+
+        // Middle of the values that land in bucket b
+        static double middle(std::size_t b) {
+            if (b < (1u << subbits))
+                return b;
+            int e = (b >> subbits) + subbits - 1;
+            uint64_t low = ((1ull << subbits) | (b & ((1u << subbits) - 1))) << (e - subbits);
+            return low + (double)(1ull << (e - subbits)) / 2;
+        }
+
+    public:
+        Histogram(void) : counts(), total(0) {}
+
+        void record(uint64_t v) {
+            counts[bucket(v)]++;
+            total++;
+        }
+
+        void merge(const Histogram& other) {
+            for (std::size_t b = 0; b < sizeof(counts) / sizeof(counts[0]); b++)
+                counts[b] += other.counts[b];
+            total += other.total;
+        }
+
+        // Value at quantile q in [0, 1]
+        double quantile(double q) const {
+            uint64_t rank = (uint64_t)(q * total);
+            if (rank >= total)
+                rank = total > 0 ? total - 1 : 0;
+            uint64_t seen = 0;
+            for (std::size_t b = 0; b < sizeof(counts) / sizeof(counts[0]); b++) {
+                seen += counts[b];
+                if (seen > rank)
+                    return middle(b);
+            }
+            return 0;
+        }
+};
@@ -1,235 +1,469 @@
 #include <iostream>
+#include <algorithm>
 #include <chrono>
 #include <vector>
-#include <unordered_map>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
 #include "davidcache.h"
+#include "markcache.h"
+#include "compactcache.h"
+#include "shardedcache.h"
+#include "concurrentcache.h"
+#include "lrucache.h"
+#include "tinylfu.h"
+#include "sampledcache.h"
+#include "arccache.h"
+#include "gdsfcache.h"
+#include "blobcache.h"
+#include "smallcache.h"
+#include "trace.h"
+#include "histogram.h"
 
-class LFUCacheMark {
-    private:
-        struct KeyVal {
-            int key;
-            int val;
-            KeyVal* prevkv;
-            KeyVal* nextkv;
-        };
+// Counts calls into the global allocator so the benchmark can report
+// allocations per op
+static std::atomic<uint64_t> allocations (0);
 
-        struct Sublist {
-            uint64_t uses;
-            KeyVal* most;
-            KeyVal* least;
-            Sublist* prevsl;
-            Sublist* nextsl;
-        };
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size))
+        return ptr;
+    throw std::bad_alloc();
+}
 
-        std::unordered_map<int,std::pair<Sublist*,KeyVal*>> cachemap;
-
-        Sublist* head;
-
-        int maxcap;
-
-        // Returns the sublist that fkv ends up in
-        Sublist* increment(Sublist* fsl, KeyVal* fkv) {
-            // Try and increment uses if fsl just contains fkv
-            if (fsl->most == fkv and fsl->least == fkv) {
-                fsl->uses++;
-                // If next has same uses we need to move fkv and delete fsl
-                if (fsl->nextsl != nullptr and fsl->nextsl->uses == fsl->uses) {
-                    // Move fkv
-                    Sublist* old = fsl;
-                    fsl = fsl->nextsl;
-                    fkv->nextkv = fsl->most;
-                    fsl->most->prevkv = fkv;
-                    fsl->most = fkv;
-                    // Unlink old
-                    if (old->prevsl != nullptr)
-                        old->prevsl->nextsl = old->nextsl;
-                    else
-                        head = old->nextsl;
-                    if (old->nextsl != nullptr)
-                        old->nextsl->prevsl = old->prevsl;
-                    delete old;
-                }
-                return fsl;
-            }
-            // Otherwise unlink and insert into correct sublist
-            else {
-                // Unlink from found sublist
-                if (fkv->prevkv != nullptr)
-                    fkv->prevkv->nextkv = fkv->nextkv;
-                else
-                    fsl->most = fkv->nextkv;
-                if (fkv->nextkv != nullptr)
-                    fkv->nextkv->prevkv = fkv->prevkv;
-                else
-                    fsl->least = fkv->prevkv;
-                // Update fkv next and prev
-                fkv->prevkv = nullptr;
-                fkv->nextkv = nullptr;
-                // Insert into uses+1 sublist
-                if (fsl->nextsl == nullptr)
-                    fsl->nextsl = new Sublist{fsl->uses + 1, fkv, fkv, fsl, nullptr};
-                else if (fsl->nextsl->uses == fsl->uses + 1) {
-                    fsl->nextsl->most->prevkv = fkv;
-                    fkv->nextkv = fsl->nextsl->most;
-                    fsl->nextsl->most = fkv;
-                }
-                else {
-                    fsl->nextsl = new Sublist{fsl->uses + 1, fkv, fkv, fsl, fsl->nextsl};
-                    if (fsl->nextsl->nextsl != nullptr)
-                        fsl->nextsl->nextsl->prevsl = fsl->nextsl;
-                }
-                return fsl->nextsl;
-            }
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+// Replays ops through get/put and reports runtime, hit ratio, allocations per
+// op and the bytes per entry held at the end. get returns whether it hit.
+template <typename Get, typename Put, typename Size, typename Bytes>
+void replay(const char* name, const Trace& ops, Get get, Put put, Size size, Bytes bytes) {
+    uint64_t startallocs = allocations;
+    uint64_t gets = 0, hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t i = 0; i < ops.size(); i++) {
+        if (ops[i].op == 'g') {
+            gets++;
+            hits += get(ops[i].key);
         }
+        else
+            put(ops[i].key, ops[i].val);
+    }
 
-    public:
-        LFUCacheMark(int capcacity) {
-            cachemap.reserve(capcacity);
-            maxcap = capcacity;
-            head = nullptr;
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> runtime = stop - start;
+
+    std::cout << name << " Runtime " << runtime.count() << " seconds, "
+              << (gets > 0 ? (double)hits / gets : 0) << " hit ratio, "
+              << (double)(allocations - startallocs) / ops.size() << " allocations/op, "
+              << (double)bytes() / size() << " bytes/entry" << std::endl;
+}
+
+// replay() for the batch APIs. Each run of consecutive gets or puts, up to 64
+// long, goes through getBatch or putBatch as one call.
+template <typename GetBatch, typename PutBatch, typename Size, typename Bytes>
+void replayBatched(const char* name, const Trace& ops, GetBatch getBatch, PutBatch putBatch, Size size, Bytes bytes) {
+    constexpr std::size_t maxbatch = 64;
+    int keys[maxbatch], vals[maxbatch];
+    uint64_t startallocs = allocations;
+    uint64_t gets = 0, hits = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (std::size_t i = 0; i < ops.size();) {
+        char op = ops[i].op;
+        std::size_t n = 0;
+        for (; n < maxbatch and i < ops.size() and ops[i].op == op; n++, i++) {
+            keys[n] = ops[i].key;
+            vals[n] = ops[i].val;
+        }
+        if (op == 'g') {
+            gets += n;
+            hits += getBatch(keys, n);
         }
+        else
+            putBatch(keys, vals, n);
+    }
 
-        ~LFUCacheMark(void) {
-            while (head != nullptr) {
-                while (head->most != nullptr) {
-                    KeyVal* okv = head->most;
-                    head->most = head->most->nextkv;
-                    delete okv;
-                }
-                Sublist* old = head;
-                head = head->nextsl;
-                delete old;
-            }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> runtime = stop - start;
+
+    std::cout << name << " Runtime " << runtime.count() << " seconds, "
+              << (gets > 0 ? (double)hits / gets : 0) << " hit ratio, "
+              << (double)(allocations - startallocs) / ops.size() << " allocations/op, "
+              << (double)bytes() / size() << " bytes/entry" << std::endl;
+}
+
+// How replayThreaded hands ops to threads: interleaved, thread t taking ops
+// t, t + nthreads, ..., or by key, each thread taking every op on its share
+// of the keys in trace order
+enum class Split {
+    interleaved,
+    keys,
+};
+
+struct ThreadOptions {
+    unsigned maxthreads;
+    Split split;
+    // Pin thread t to the t-th CPU this process may run on
+    bool pin;
+};
+
+// What one replay thread did, a cache line apart from its neighbours
+struct alignas(64) ThreadResult {
+    uint64_t ops;
+    uint64_t elapsed;
+    int cpu;
+    Histogram latency;
+};
+
+// CPUs this process may run on
+static std::vector<int> allowedCpus(void) {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
         }
+    }
+    return cpus;
+}
+
+static bool pinTo(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
 
-        int get(int key) {
-            auto mapres = cachemap.find(key);
-            if (mapres != cachemap.end()) {
-                // Increment uses if found
-                Sublist* fsl = mapres->second.first;
-                KeyVal* fkv = mapres->second.second;
-                fsl = increment(fsl, fkv);
-                cachemap[key] = std::make_pair(fsl, fkv);
-                return fkv->val;
+// Replays ops on 1, 2, 4, ... threads up to maxthreads and reports, for each
+// count, aggregate throughput and scaling over 1 thread with latency
+// percentiles over all ops, and then each thread's own. Like bench, each count
+// makes two passes over the same cache, one timing only whole loops for
+// throughput and one timing every op into its thread's Histogram, so the
+// clock reads do not slow the throughput pass. In each pass threads are
+// started and pinned first and released together once all are waiting.
+template <typename Get, typename Put>
+void replayThreaded(const char* name, const Trace& ops, const ThreadOptions& opts, Get get, Put put) {
+    std::vector<int> cpus = allowedCpus();
+    double base = 0;
+    auto apply = [&](const TraceOp& op) {
+        if (op.op == 'g')
+            get(op.key);
+        else
+            put(op.key, op.val);
+    };
+    for (unsigned nthreads = 1;; nthreads = std::min(nthreads * 2, opts.maxthreads)) {
+        // Split by key up front, so the timed loops only walk their own ops.
+        // The thread comes from the high bits of a multiplicative hash, the
+        // low bits of key * odd are just the low bits of key.
+        std::vector<std::vector<TraceOp>> parts (opts.split == Split::keys ? nthreads : 0);
+        if (not parts.empty()) {
+            for (const TraceOp& op : ops) {
+                uint32_t h = (uint32_t)op.key * 2654435769u;
+                parts[((uint64_t)h * nthreads) >> 32].push_back(op);
             }
-            return -1;
         }
 
-        void put(int key, int val) {
-            if (maxcap <= 0)
-                return;
-            auto mapres = cachemap.find(key);
-            // If key is already in the cache then just increment its uses
-            if (mapres != cachemap.end()) {
-                Sublist* fsl = mapres->second.first;
-                KeyVal* fkv = mapres->second.second;
-                fsl = increment(fsl, fkv);
-                fkv->val = val;
-                cachemap[key] = std::make_pair(fsl, fkv);
-            }
-            else {
-                KeyVal* nkv;
-                // Create a new KeyVal if there is space
-                if (cachemap.size() < maxcap)
-                    nkv = new KeyVal();
-                // Otherwise evict (Reuse the evictee)
-                else {
-                    cachemap.erase(head->least->key);
-                    nkv = head->least;
-                    // Unlink least recently used from head;
-                    head->least = nkv->prevkv;
-                    if (nkv->prevkv != nullptr)
-                        nkv->prevkv->nextkv = nullptr;
-                    else
-                        head->most = nullptr;
-                    // Delete head if it's empty
-                    if (head->most == nullptr and head->least == nullptr) {
-                        Sublist* old = head;
-                        head = head->nextsl;
-                        delete old;
+        std::vector<ThreadResult> results (nthreads);
+        double nspertick = 0;
+        // Runs every thread over its ops once and returns the wall time. The
+        // throughput pass also calibrates ticks against it.
+        auto pass = [&](bool latency) {
+            std::atomic<unsigned> ready (0);
+            std::atomic<bool> go (false);
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < nthreads; t++) {
+                threads.emplace_back([&, t]() {
+                    ThreadResult& res = results[t];
+                    res.cpu = -1;
+                    if (opts.pin and not cpus.empty() and pinTo(cpus[t % cpus.size()]))
+                        res.cpu = cpus[t % cpus.size()];
+                    const TraceOp* data = parts.empty() ? ops.begin() : parts[t].data();
+                    std::size_t n = parts.empty() ? ops.size() : parts[t].size();
+                    std::size_t first = parts.empty() ? t : 0;
+                    std::size_t stride = parts.empty() ? nthreads : 1;
+
+                    ready++;
+                    while (not go.load(std::memory_order_acquire))
+                        std::this_thread::yield();
+                    if (latency) {
+                        for (std::size_t i = first; i < n; i += stride) {
+                            uint64_t before = ticks();
+                            apply(data[i]);
+                            res.latency.record(ticks() - before);
+                        }
+                        return;
                     }
-                }
-                // (Re)set members of nkv
-                nkv->key = key;
-                nkv->val = val;
-                nkv->prevkv = nullptr;
-                nkv->nextkv = nullptr;
-                // Insert nkv into correct head
-                if (head == nullptr)
-                    head = new Sublist{1, nkv, nkv, nullptr, nullptr};
-                else if (head->uses > 1) {
-                    head->prevsl = new Sublist{1, nkv, nkv, nullptr, head};
-                    head = head->prevsl;
-                }
-                else {
-                    head->most->prevkv = nkv;
-                    nkv->nextkv = head->most;
-                    head->most = nkv;
-                }
-                cachemap[key] = std::make_pair(head, head->most);
+                    uint64_t start = ticks();
+                    uint64_t count = 0;
+                    for (std::size_t i = first; i < n; i += stride, count++)
+                        apply(data[i]);
+                    res.elapsed = ticks() - start;
+                    res.ops = count;
+                });
             }
-        }
+            while (ready.load() < nthreads)
+                std::this_thread::yield();
 
-        void print(void) {
-            Sublist* csl = head;
-            while (csl != nullptr) {
-                std::cout << "[ " << csl->uses << " ( ";
-                KeyVal* ckv = csl->most;
-                while (ckv != nullptr) {
-                    std::cout << ckv->key << " ";
-                    ckv = ckv->nextkv;
-                }
-                std::cout << ") ] ";
-                csl = csl->nextsl;
-            }
-            std::cout << std::endl;
+            auto start = std::chrono::steady_clock::now();
+            uint64_t startticks = ticks();
+            go.store(true, std::memory_order_release);
+            for (std::thread& thread : threads)
+                thread.join();
+            uint64_t stopticks = ticks();
+            std::chrono::duration<double> runtime = std::chrono::steady_clock::now() - start;
+            if (not latency and stopticks > startticks)
+                nspertick = runtime.count() * 1e9 / (stopticks - startticks);
+            return runtime.count();
+        };
+
+        double runtime = pass(false);
+        pass(true);
+
+        Histogram all;
+        for (const ThreadResult& res : results)
+            all.merge(res.latency);
+        double throughput = ops.size() / runtime;
+        if (nthreads == 1)
+            base = throughput;
+        std::cout << name << " " << nthreads << " threads " << throughput / 1e6 << " Mops/s, "
+                  << throughput / base << "x, p50 " << all.quantile(0.5) * nspertick
+                  << " ns, p99 " << all.quantile(0.99) * nspertick
+                  << " ns, p99.9 " << all.quantile(0.999) * nspertick << " ns" << std::endl;
+        for (unsigned t = 0; t < nthreads; t++) {
+            const ThreadResult& res = results[t];
+            double seconds = res.elapsed * nspertick / 1e9;
+            std::cout << "    thread " << t << " (cpu " << res.cpu << ") " << res.ops << " ops, "
+                      << (seconds > 0 ? res.ops / seconds / 1e6 : 0) << " Mops/s, p50 "
+                      << res.latency.quantile(0.5) * nspertick
+                      << " ns, p99 " << res.latency.quantile(0.99) * nspertick
+                      << " ns, p99.9 " << res.latency.quantile(0.999) * nspertick << " ns" << std::endl;
         }
-};
+        if (nthreads == opts.maxthreads)
+            break;
+    }
+}
 
-int main(void) {
+// lfucache < ops                  replays text ops through each engine
+// lfucache trace                  replays a binary trace in place
+// lfucache convert trace < ops    converts text ops into a binary trace
+// lfucache threads [options] [shards] [trace]
+//                                 replays ops through ShardedLFUCache and
+//                                 ConcurrentLFUCache on 1 to all cores, next
+//                                 to a single mutex around one shard
+//   --threads n                   stop at n threads instead of all cores
+//   --split interleaved|keys      hand threads every nth op or their own keys
+//                                 (interleaved)
+//   --nopin                       leave threads unpinned
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
 
-    // Preload the ops
-    uint64_t numops;
-    std::cin >> numops;
+    if (argc > 2 and std::strcmp(argv[1], "convert") == 0) {
+        if (not Trace::convert(std::cin, argv[2])) {
+            std::cerr << "Could not convert ops into " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-    std::vector<std::pair<char,std::pair<int,int>>> ops (numops);
+    bool threaded = argc > 1 and std::strcmp(argv[1], "threads") == 0;
+    const char* path = nullptr;
+    int nshards = 16;
+    ThreadOptions topts = {std::max(1u, std::thread::hardware_concurrency()), Split::interleaved, true};
+    for (int i = threaded ? 2 : 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (threaded and std::strcmp(argv[i], "--threads") == 0 and more)
+            topts.maxthreads = std::max(1, std::atoi(argv[++i]));
+        else if (threaded and std::strcmp(argv[i], "--split") == 0 and more
+                 and (std::strcmp(argv[i + 1], "interleaved") == 0 or std::strcmp(argv[i + 1], "keys") == 0))
+            topts.split = std::strcmp(argv[++i], "keys") == 0 ? Split::keys : Split::interleaved;
+        else if (threaded and std::strcmp(argv[i], "--nopin") == 0)
+            topts.pin = false;
+        // A bare number is the shard count
+        else if (threaded and std::strspn(argv[i], "0123456789") == std::strlen(argv[i]))
+            nshards = std::max(1, std::atoi(argv[i]));
+        else if (argv[i][0] != '-' and path == nullptr)
+            path = argv[i];
+        else {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
 
-    for (int i = 0; i < ops.size(); i++) {
-        char op;
-        int key, val;
-        std::cin >> op;
-        if (op == 'g')
-            std::cin >> key;
-        else
-            std::cin >> key >> val;
-        ops[i] = std::make_pair(op, std::make_pair(key, 0));
+    // Map the trace, or preload text ops
+    Trace ops;
+    if (path != nullptr ? not ops.map(path) : not ops.read(std::cin)) {
+        std::cerr << "Could not load ops from " << (path != nullptr ? path : "stdin") << std::endl;
+        return 1;
     }
 
     // Actually run
-    auto start = std::chrono::high_resolution_clock::now();
+    if (threaded) {
+        {
+            ShardedLFUCache<int,int> cache (10, 1);
+            replayThreaded("Single mutex", ops, topts,
+                           [&](int key) { return cache.get(key); },
+                           [&](int key, int val) { cache.put(key, val); });
+        }
+        {
+            ShardedLFUCache<int,int> cache (10, nshards);
+            replayThreaded("ShardedLFUCache", ops, topts,
+                           [&](int key) { return cache.get(key); },
+                           [&](int key, int val) { cache.put(key, val); });
+        }
+        {
+            ConcurrentLFUCache<int,int> cache (10, nshards);
+            replayThreaded("ConcurrentLFUCache", ops, topts,
+                           [&](int key) { return cache.get(key); },
+                           [&](int key, int val) { cache.put(key, val); });
+        }
+        return 0;
+    }
 
-    // LFUCacheMark cache (10);
+    {
+        LFUCacheMark<int,int> cache (10, false);
+        replay("LFUCacheMark", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
 
-    // for (int i = 0; i < ops.size(); i++) {
-    //     if (ops[i].first == 'g')
-    //         cache.get(ops[i].second.first);
-    //     else
-    //         cache.put(ops[i].second.first, ops[i].second.second);
-    // }
+    {
+        LFUCacheMark<int,int> cache (10);
+        replay("LFUCacheMark (pooled)", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
 
-    LFUCache *cache = lFUCacheCreate(10);
+    {
+        LFUCacheMark<int,int> cache (10);
+        int* out[64];
+        replayBatched("LFUCacheMark (batched)", ops,
+                      [&](const int* keys, std::size_t n) {
+                          cache.getBatch(keys, n, out);
+                          return std::count_if(out, out + n, [](int* val) { return val != nullptr; });
+                      },
+                      [&](const int* keys, int* vals, std::size_t n) { cache.putBatch(keys, vals, n); },
+                      [&]() { return cache.size(); },
+                      [&]() { return cache.bytes(); });
+    }
 
-    for (int i = 0; i < ops.size(); i++) {
-        if (ops[i].first == 'g')
-            lFUCacheGet(cache, ops[i].second.first);
-        else
-            lFUCachePut(cache, ops[i].second.first, ops[i].second.second);
+    {
+        LFUCacheMark<int,int> cache (10, true, true);
+        replay("LFUCacheMark (aging)", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
     }
 
-    auto stop = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> runtime = stop - start;
+    {
+        WTinyLFUCache<int,int> cache (10);
+        replay("WTinyLFUCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    {
+        SampledLFUCache<int,int> cache (10);
+        replay("SampledLFUCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    {
+        ARCCache<int,int> cache (10);
+        replay("ARCCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    // Unit cost and size, which makes GDSF LFU with dynamic aging
+    {
+        GDSFCache<int,int> cache (10);
+        replay("GDSFCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    // Values stored as 4 byte blobs, with a budget that holds 10 of them
+    {
+        BlobLFUCache<int> cache (4096, 10);
+        replay("BlobLFUCache", ops,
+               [&](int key) { return (bool)cache.get(key); },
+               [&](int key, int val) { cache.put(key, std::string_view((const char*)&val, sizeof(val))); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    {
+        SmallLFUCache<10> cache;
+        replay("SmallLFUCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    {
+        LRUCache<int,int> cache (10);
+        replay("LRUCache", ops,
+               [&](int key) { return cache.get(key) != nullptr; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    {
+        LFUCacheCompact cache (10);
+        replay("LFUCacheCompact", ops,
+               [&](int key) { return cache.get(key) != -1; },
+               [&](int key, int val) { cache.put(key, val); },
+               [&]() { return cache.size(); },
+               [&]() { return cache.bytes(); });
+    }
+
+    // davidcache allocates with malloc, which is not counted
+    LFUCache *cache = lFUCacheCreate(10);
+    replay("LFUCache", ops,
+           [&](int key) { return lFUCacheGet(cache, key) != -1; },
+           [&](int key, int val) { lFUCachePut(cache, key, val); },
+           [&]() { return cache->size; },
+           [&]() { return lFUCacheBytes(cache); });
+    lFUCacheFree(cache);
 
-    std::cout << "Runtime " << runtime.count() << " seconds" << std::endl;
+    cache = lFUCacheCreate(10);
+    int out[64];
+    replayBatched("LFUCache (batched)", ops,
+                  [&](const int* keys, std::size_t n) {
+                      lFUCacheGetBatch(cache, keys, n, out);
+                      return std::count_if(out, out + n, [](int val) { return val != -1; });
+                  },
+                  [&](const int* keys, const int* vals, std::size_t n) { lFUCachePutBatch(cache, keys, vals, n); },
+                  [&]() { return cache->size; },
+                  [&]() { return lFUCacheBytes(cache); });
+    lFUCacheFree(cache);
 
     return 0;
-}
\ No newline at end of file
+}
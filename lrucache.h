@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "nodepool.h"
+#include "flatindex.h"
+
+// Plain LRU cache built from the same parts as LFUCacheMark: pooled nodes on
+// one recency list, most recently used at the front, indexed by a FlatIndex.
+// Used as the admission window of WTinyLFUCache and as a baseline.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class LRUCache {
+    private:
+        struct Node {
+            Key key;
+            Value val;
+            Node* prev;
+            Node* next;
+
+            template <typename K, typename... Args>
+            Node(K&& key, Args&&... args)
+                : key(std::forward<K>(key)), val(std::forward<Args>(args)...),
+                  prev(nullptr), next(nullptr) {}
+        };
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        using Slot = typename FlatIndex<Node*, Rebind<Node*>>::Slot;
+
+        FlatIndex<Node*, Rebind<Node*>> index;
+
+        // Most and least recently used
+        Node* mru;
+        Node* lru;
+
+        int maxcap;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        NodePool<Node, Rebind<Node>> pool;
+
+        template <typename K>
+        Slot* lookup(const K& key, std::size_t hash) {
+            return index.find(hash, [&](Node* n) { return equal(n->key, key); });
+        }
+
+        void unlink(Node* n) {
+            if (n->prev != nullptr)
+                n->prev->next = n->next;
+            else
+                mru = n->next;
+            if (n->next != nullptr)
+                n->next->prev = n->prev;
+            else
+                lru = n->prev;
+        }
+
+        void pushFront(Node* n) {
+            n->prev = nullptr;
+            n->next = mru;
+            if (mru != nullptr)
+                mru->prev = n;
+            else
+                lru = n;
+            mru = n;
+        }
+
+    public:
+        LRUCache(int capacity, const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                 const Alloc& alloc = Alloc())
+            : index(capacity, Rebind<Node*>(alloc)), mru(nullptr), lru(nullptr),
+              maxcap(capacity), hasher(hasher), equal(equal),
+              pool(capacity > 0 ? capacity : 0, true, Rebind<Node>(alloc)) {}
+
+        LRUCache(const LRUCache&) = delete;
+        LRUCache& operator=(const LRUCache&) = delete;
+
+        ~LRUCache(void) {
+            while (mru != nullptr) {
+                Node* old = mru;
+                mru = mru->next;
+                pool.destroy(old);
+            }
+        }
+
+        // Returns the cached value and makes it the most recently used, or
+        // nullptr
+        template <typename K>
+        Value* get(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return nullptr;
+            Node* n = slot->val;
+            if (n != mru) {
+                unlink(n);
+                pushFront(n);
+            }
+            return &n->val;
+        }
+
+        // Returns the cached value without making it the most recently used,
+        // or nullptr
+        template <typename K>
+        Value* peek(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            return slot != nullptr ? &slot->val->val : nullptr;
+        }
+
+        // Inserts or overwrites the value for key, evicting the least recently
+        // used if the cache is full
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            if (maxcap <= 0)
+                return;
+            std::size_t hash = hasher(key);
+            Slot* slot = lookup(key, hash);
+            if (slot != nullptr) {
+                Node* n = slot->val;
+                n->val = std::forward<V>(val);
+                if (n != mru) {
+                    unlink(n);
+                    pushFront(n);
+                }
+                return;
+            }
+            Node* n;
+            if (index.size() < (std::size_t)maxcap)
+                n = pool.create(std::forward<K>(key), std::forward<V>(val));
+            else {
+                Node* old = lru;
+                index.erase(lookup(old->key, hasher(old->key)));
+                unlink(old);
+                n = pool.recycle(old, std::forward<K>(key), std::forward<V>(val));
+            }
+            pushFront(n);
+            index.insert(hash)->val = n;
+        }
+
+        // The key that would be evicted next, or nullptr if empty
+        const Key* victim(void) const {
+            return lru != nullptr ? &lru->key : nullptr;
+        }
+
+        // Removes the least recently used entry and moves it out
+        std::optional<std::pair<Key,Value>> evict(void) {
+            if (lru == nullptr)
+                return std::nullopt;
+            Node* old = lru;
+            index.erase(lookup(old->key, hasher(old->key)));
+            unlink(old);
+            std::optional<std::pair<Key,Value>> entry (std::in_place, std::move(old->key), std::move(old->val));
+            pool.destroy(old);
+            return entry;
+        }
+
+        // Removes key and moves its value out, if present
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return std::nullopt;
+            Node* n = slot->val;
+            index.erase(slot);
+            unlink(n);
+            std::optional<Value> val (std::move(n->val));
+            pool.destroy(n);
+            return val;
+        }
+
+        std::size_t size(void) const {
+            return index.size();
+        }
+
+        int capacity(void) const {
+            return maxcap;
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) + index.bytes() + pool.bytes();
+        }
+};
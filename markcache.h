@@ -0,0 +1,503 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "nodepool.h"
+#include "flatindex.h"
+#include "cachestats.h"
+
+// Exact LFU cache, ties broken by evicting the least recently used. KeyVals
+// with the same number of uses hang off one Sublist, most recently used
+// first, and the Sublists are kept in increasing order of uses so head->least
+// is always the victim.
+//
+// With aging on (LFU with dynamic aging) the cache keeps an age, the uses of
+// the last evicted KeyVal, and new keys start at age + 1 uses instead of 1, so
+// a key that was hot long ago is eventually outranked by newer keys and
+// evicted. Every KeyVal has at least age uses, so a new key still goes in at
+// or right after head.
+//
+// Values are moved in and out, never copied, and with a transparent Hash and
+// KeyEqual (both defining is_transparent) lookups accept anything those
+// accept, e.g. std::string_view against std::string keys.
+//
+// With Stats = CountingStats the cache counts hits, misses, inserts, updates,
+// evictions and the index probe lengths of get, peek and put, reported by
+// stats(). The default NoStats compiles to the same code as no counting at
+// all.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>,
+          typename Stats = NoStats>
+class LFUCacheMark : private Stats {
+    private:
+        template <typename, typename, typename, typename, typename>
+        friend class ConcurrentLFUCache;
+
+        struct KeyVal {
+            Key key;
+            Value val;
+            KeyVal* prevkv;
+            KeyVal* nextkv;
+
+            template <typename K, typename... Args>
+            KeyVal(K&& key, Args&&... args)
+                : key(std::forward<K>(key)), val(std::forward<Args>(args)...),
+                  prevkv(nullptr), nextkv(nullptr) {}
+        };
+
+        struct Sublist {
+            uint64_t uses;
+            KeyVal* most;
+            KeyVal* least;
+            Sublist* prevsl;
+            Sublist* nextsl;
+        };
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        // Keys per group in getBatch and putBatch, enough misses in flight to
+        // cover memory latency without the prefetched lines being evicted
+        static constexpr std::size_t batchgroup = 16;
+
+        using Entry = std::pair<Sublist*,KeyVal*>;
+        using Slot = typename FlatIndex<Entry, Rebind<Entry>>::Slot;
+
+        template <typename T, typename = void>
+        struct Transparent : std::false_type {};
+
+        template <typename T>
+        struct Transparent<T, std::void_t<typename T::is_transparent>> : std::true_type {};
+
+        // Whether a K can be hashed and compared as is, otherwise it is turned
+        // into a Key first
+        template <typename K>
+        static constexpr bool direct = std::is_same_v<std::decay_t<K>, Key>
+            or (Transparent<Hash>::value and Transparent<KeyEqual>::value);
+
+        FlatIndex<Entry, Rebind<Entry>> cachemap;
+
+        Sublist* head;
+
+        int maxcap;
+
+        // Uses of the last evicted KeyVal, always 0 without aging
+        uint64_t age;
+        bool aging;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        // When pooled, nodes come from slabs sized from the capacity instead
+        // of one allocation each
+        NodePool<KeyVal, Rebind<KeyVal>> kvpool;
+        NodePool<Sublist, Rebind<Sublist>> slpool;
+
+        template <typename K>
+        Slot* lookup(const K& key, std::size_t hash) {
+            return cachemap.find(hash, [&](const Entry& e) { return equal(e.second->key, key); });
+        }
+
+        // lookup for get, peek and put, the only lookups whose probe lengths
+        // are counted, so internal ones like re-finding a victim do not skew
+        // the histogram
+        template <typename K>
+        Slot* countedLookup(const K& key, std::size_t hash) {
+            Slot* slot = lookup(key, hash);
+            if constexpr (Stats::enabled)
+                Stats::probe(cachemap.probes(hash, slot));
+            return slot;
+        }
+
+        // Returns the sublist that fkv ends up in
+        Sublist* increment(Sublist* fsl, KeyVal* fkv) {
+            // Try and increment uses if fsl just contains fkv
+            if (fsl->most == fkv and fsl->least == fkv) {
+                fsl->uses++;
+                // If next has same uses we need to move fkv and delete fsl
+                if (fsl->nextsl != nullptr and fsl->nextsl->uses == fsl->uses) {
+                    // Move fkv
+                    Sublist* old = fsl;
+                    fsl = fsl->nextsl;
+                    fkv->nextkv = fsl->most;
+                    fsl->most->prevkv = fkv;
+                    fsl->most = fkv;
+                    // Unlink old
+                    if (old->prevsl != nullptr)
+                        old->prevsl->nextsl = old->nextsl;
+                    else
+                        head = old->nextsl;
+                    if (old->nextsl != nullptr)
+                        old->nextsl->prevsl = old->prevsl;
+                    slpool.destroy(old);
+                }
+                return fsl;
+            }
+            // Otherwise unlink and insert into correct sublist
+            else {
+                // Unlink from found sublist
+                if (fkv->prevkv != nullptr)
+                    fkv->prevkv->nextkv = fkv->nextkv;
+                else
+                    fsl->most = fkv->nextkv;
+                if (fkv->nextkv != nullptr)
+                    fkv->nextkv->prevkv = fkv->prevkv;
+                else
+                    fsl->least = fkv->prevkv;
+                // Update fkv next and prev
+                fkv->prevkv = nullptr;
+                fkv->nextkv = nullptr;
+                // Insert into uses+1 sublist
+                if (fsl->nextsl == nullptr)
+                    fsl->nextsl = slpool.create(fsl->uses + 1, fkv, fkv, fsl, nullptr);
+                else if (fsl->nextsl->uses == fsl->uses + 1) {
+                    fsl->nextsl->most->prevkv = fkv;
+                    fkv->nextkv = fsl->nextsl->most;
+                    fsl->nextsl->most = fkv;
+                }
+                else {
+                    fsl->nextsl = slpool.create(fsl->uses + 1, fkv, fkv, fsl, fsl->nextsl);
+                    if (fsl->nextsl->nextsl != nullptr)
+                        fsl->nextsl->nextsl->prevsl = fsl->nextsl;
+                }
+                return fsl->nextsl;
+            }
+        }
+
+        // Drops the entry in slot from the index and its sublist, deleting the
+        // sublist if that leaves it empty. Returns the unlinked KeyVal.
+        KeyVal* remove(Slot* slot) {
+            Sublist* fsl = slot->val.first;
+            KeyVal* fkv = slot->val.second;
+            cachemap.erase(slot);
+            if (fkv->prevkv != nullptr)
+                fkv->prevkv->nextkv = fkv->nextkv;
+            else
+                fsl->most = fkv->nextkv;
+            if (fkv->nextkv != nullptr)
+                fkv->nextkv->prevkv = fkv->prevkv;
+            else
+                fsl->least = fkv->prevkv;
+            if (fsl->most == nullptr) {
+                if (fsl->prevsl != nullptr)
+                    fsl->prevsl->nextsl = fsl->nextsl;
+                else
+                    head = fsl->nextsl;
+                if (fsl->nextsl != nullptr)
+                    fsl->nextsl->prevsl = fsl->prevsl;
+                slpool.destroy(fsl);
+            }
+            return fkv;
+        }
+
+        // Unlinks the least recently used of the least used and returns it
+        KeyVal* evict(void) {
+            Stats::evict();
+            if (aging)
+                age = head->uses;
+            const Key& key = head->least->key;
+            return remove(lookup(key, hasher(key)));
+        }
+
+        // Hashes keys and prefetches first their index slots and then the
+        // KeyVals those slots point at, so a following lookup of each key
+        // finds everything in cache. The KeyVal prefetched is the first with
+        // a matching hash, which is almost always the key's own.
+        void prefetchGroup(const Key* keys, std::size_t m, std::size_t* hashes) {
+            for (std::size_t i = 0; i < m; i++) {
+                hashes[i] = hasher(keys[i]);
+                cachemap.prefetch(hashes[i]);
+            }
+            for (std::size_t i = 0; i < m; i++) {
+                Slot* slot = cachemap.find(hashes[i], [](const Entry&) { return true; });
+                if (slot != nullptr)
+                    __builtin_prefetch(slot->val.second);
+            }
+        }
+
+        // Counts a use of key if present, otherwise builds a KeyVal for it from
+        // args, evicting first if the cache is full. Returns the KeyVal and
+        // whether it was inserted.
+        template <typename K, typename... Args>
+        std::pair<KeyVal*,bool> findOrEmplace(std::size_t hash, K&& key, Args&&... args) {
+            Slot* mapres = countedLookup(key, hash);
+            // If key is already in the cache then just increment its uses
+            if (mapres != nullptr) {
+                KeyVal* fkv = mapres->val.second;
+                mapres->val.first = increment(mapres->val.first, fkv);
+                Stats::update();
+                return std::make_pair(fkv, false);
+            }
+            Stats::insert();
+            KeyVal* nkv;
+            // Create a new KeyVal if there is space
+            if (cachemap.size() < (std::size_t)maxcap)
+                nkv = kvpool.create(std::forward<K>(key), std::forward<Args>(args)...);
+            // Otherwise evict (Reuse the evictee)
+            else
+                nkv = kvpool.recycle(evict(), std::forward<K>(key), std::forward<Args>(args)...);
+            // Insert nkv into the age + 1 sublist, head or the one after it
+            uint64_t uses = age + 1;
+            Sublist* prev = nullptr;
+            Sublist* next = head;
+            if (next != nullptr and next->uses < uses) {
+                prev = next;
+                next = next->nextsl;
+            }
+            Sublist* nsl;
+            if (next != nullptr and next->uses == uses) {
+                nsl = next;
+                nsl->most->prevkv = nkv;
+                nkv->nextkv = nsl->most;
+                nsl->most = nkv;
+            }
+            else {
+                nsl = slpool.create(uses, nkv, nkv, prev, next);
+                if (prev != nullptr)
+                    prev->nextsl = nsl;
+                else
+                    head = nsl;
+                if (next != nullptr)
+                    next->prevsl = nsl;
+            }
+            cachemap.insert(hash)->val = std::make_pair(nsl, nkv);
+            return std::make_pair(nkv, true);
+        }
+
+    public:
+        // A cache never holds more than capacity KeyVals and capacity + 1
+        // Sublists (one extra while increment() splits a sublist), so a
+        // single slab of each covers the steady state
+        LFUCacheMark(int capcacity, bool pooled = true, bool aging = false,
+                     const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                     const Alloc& alloc = Alloc())
+            : cachemap(capcacity, Rebind<Entry>(alloc)),
+              hasher(hasher), equal(equal),
+              kvpool(capcacity > 0 ? capcacity : 0, pooled, Rebind<KeyVal>(alloc)),
+              slpool(capcacity > 0 ? capcacity + 1 : 0, pooled, Rebind<Sublist>(alloc)) {
+            maxcap = capcacity;
+            head = nullptr;
+            age = 0;
+            this->aging = aging;
+        }
+
+        LFUCacheMark(const LFUCacheMark&) = delete;
+        LFUCacheMark& operator=(const LFUCacheMark&) = delete;
+
+        ~LFUCacheMark(void) {
+            while (head != nullptr) {
+                while (head->most != nullptr) {
+                    KeyVal* okv = head->most;
+                    head->most = head->most->nextkv;
+                    kvpool.destroy(okv);
+                }
+                Sublist* old = head;
+                head = head->nextsl;
+                slpool.destroy(old);
+            }
+        }
+
+        // Returns the cached value after counting a use, or nullptr. The
+        // pointer stays valid until key is evicted or extracted.
+        template <typename K>
+        Value* get(const K& key) {
+            if constexpr (not direct<K>)
+                return get(Key(key));
+            else {
+                Slot* mapres = countedLookup(key, hasher(key));
+                if (mapres == nullptr) {
+                    Stats::miss();
+                    return nullptr;
+                }
+                Stats::hit();
+                // Increment uses if found
+                KeyVal* fkv = mapres->val.second;
+                mapres->val.first = increment(mapres->val.first, fkv);
+                return &fkv->val;
+            }
+        }
+
+        // Returns the cached value without counting a use, or nullptr
+        template <typename K>
+        Value* peek(const K& key) {
+            if constexpr (not direct<K>)
+                return peek(Key(key));
+            else {
+                Slot* mapres = countedLookup(key, hasher(key));
+                return mapres != nullptr ? &mapres->val.second->val : nullptr;
+            }
+        }
+
+        // Inserts or overwrites the value for key, counting a use
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            if constexpr (not direct<K>)
+                put(Key(std::forward<K>(key)), std::forward<V>(val));
+            else {
+                if (maxcap <= 0)
+                    return;
+                std::size_t hash = hasher(key);
+                auto res = findOrEmplace(hash, std::forward<K>(key), std::forward<V>(val));
+                // val was only consumed if a KeyVal was built from it
+                if (not res.second)
+                    res.first->val = std::forward<V>(val);
+            }
+        }
+
+        // Like put, but builds the value in place from args. Returns the
+        // stored value, or nullptr if the cache has no capacity.
+        template <typename K, typename... Args>
+        Value* emplace(K&& key, Args&&... args) {
+            if constexpr (not direct<K>)
+                return emplace(Key(std::forward<K>(key)), std::forward<Args>(args)...);
+            else {
+                if (maxcap <= 0)
+                    return nullptr;
+                std::size_t hash = hasher(key);
+                auto res = findOrEmplace(hash, std::forward<K>(key), std::forward<Args>(args)...);
+                if (not res.second)
+                    res.first->val = Value(std::forward<Args>(args)...);
+                return &res.first->val;
+            }
+        }
+
+        // get for each of n keys, out[i] getting what get(keys[i]) would
+        // return. Keys are taken in groups whose index slots, KeyVals and
+        // Sublists are all prefetched before any use is counted, so their
+        // cache misses overlap instead of each lookup waiting on its own.
+        void getBatch(const Key* keys, std::size_t n, Value** out) {
+            std::size_t hashes[batchgroup];
+            Slot* slots[batchgroup];
+            for (std::size_t base = 0; base < n; base += batchgroup) {
+                std::size_t m = std::min(batchgroup, n - base);
+                prefetchGroup(keys + base, m, hashes);
+                for (std::size_t i = 0; i < m; i++) {
+                    slots[i] = countedLookup(keys[base + i], hashes[i]);
+                    if (slots[i] != nullptr)
+                        __builtin_prefetch(slots[i]->val.first);
+                }
+                // increment() relinks the KeyVal's neighbours and the next
+                // Sublist's most recent KeyVal
+                for (std::size_t i = 0; i < m; i++) {
+                    if (slots[i] != nullptr) {
+                        KeyVal* fkv = slots[i]->val.second;
+                        __builtin_prefetch(fkv->prevkv);
+                        __builtin_prefetch(fkv->nextkv);
+                        __builtin_prefetch(slots[i]->val.first->nextsl);
+                    }
+                }
+                for (std::size_t i = 0; i < m; i++) {
+                    if (slots[i] != nullptr and slots[i]->val.first->nextsl != nullptr)
+                        __builtin_prefetch(slots[i]->val.first->nextsl->most);
+                }
+                // Counting uses never moves index slots
+                for (std::size_t i = 0; i < m; i++) {
+                    if (slots[i] == nullptr) {
+                        Stats::miss();
+                        out[base + i] = nullptr;
+                        continue;
+                    }
+                    Stats::hit();
+                    KeyVal* fkv = slots[i]->val.second;
+                    slots[i]->val.first = increment(slots[i]->val.first, fkv);
+                    out[base + i] = &fkv->val;
+                }
+            }
+        }
+
+        // put for each of n keys in order, moving the values out of vals.
+        // Each group is prefetched like getBatch before its puts run.
+        void putBatch(const Key* keys, Value* vals, std::size_t n) {
+            if (maxcap <= 0)
+                return;
+            std::size_t hashes[batchgroup];
+            for (std::size_t base = 0; base < n; base += batchgroup) {
+                std::size_t m = std::min(batchgroup, n - base);
+                prefetchGroup(keys + base, m, hashes);
+                for (std::size_t i = 0; i < m; i++) {
+                    auto res = findOrEmplace(hashes[i], keys[base + i], std::move(vals[base + i]));
+                    if (not res.second)
+                        res.first->val = std::move(vals[base + i]);
+                }
+            }
+        }
+
+        // Removes key and moves its value out, if present
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            if constexpr (not direct<K>)
+                return extract(Key(key));
+            else {
+                Slot* mapres = lookup(key, hasher(key));
+                if (mapres == nullptr)
+                    return std::nullopt;
+                KeyVal* fkv = remove(mapres);
+                std::optional<Value> val (std::move(fkv->val));
+                kvpool.destroy(fkv);
+                return val;
+            }
+        }
+
+        std::size_t size(void) const {
+            return cachemap.size();
+        }
+
+        int capacity(void) const {
+            return maxcap;
+        }
+
+        // The key that would be evicted next, or nullptr if empty
+        const Key* victim(void) const {
+            return head != nullptr ? &head->least->key : nullptr;
+        }
+
+        // Heap bytes held by the cache, including its own footprint
+        std::size_t bytes(void) const {
+            return sizeof(*this) + cachemap.bytes() + kvpool.bytes() + slpool.bytes();
+        }
+
+        // What bytes() reaches once the cache is full, for owners that budget
+        // memory up front
+        std::size_t fullBytes(void) const {
+            std::size_t cap = maxcap > 0 ? maxcap : 0;
+            return sizeof(*this) + cachemap.bytes() + cap * sizeof(KeyVal) + (cap + 1) * sizeof(Sublist);
+        }
+
+        // Counters so far, with the current frequency list sizes. Only with
+        // Stats = CountingStats.
+        CacheStats stats(void) const {
+            static_assert(Stats::enabled, "stats() needs Stats = CountingStats");
+            CacheStats res = Stats::counters();
+            for (const Sublist* csl = head; csl != nullptr; csl = csl->nextsl) {
+                uint64_t n = 0;
+                for (const KeyVal* ckv = csl->most; ckv != nullptr; ckv = ckv->nextkv)
+                    n++;
+                res.listsizes[CacheStats::bucket(n)]++;
+            }
+            return res;
+        }
+
+        void print(void) {
+            Sublist* csl = head;
+            while (csl != nullptr) {
+                std::cout << "[ " << csl->uses << " ( ";
+                KeyVal* ckv = csl->most;
+                while (ckv != nullptr) {
+                    std::cout << ckv->key << " ";
+                    ckv = ckv->nextkv;
+                }
+                std::cout << ") ] ";
+                csl = csl->nextsl;
+            }
+            std::cout << std::endl;
+        }
+};
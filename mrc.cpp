@@ -0,0 +1,222 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "markcache.h"
+#include "lrucache.h"
+#include "tinylfu.h"
+#include "arccache.h"
+#include "trace.h"
+
+// Hit ratio curve of an engine over many capacities from one pass over the
+// trace, by spatial sampling (SHARDS, Waldspurger et al.). A key is sampled
+// when its hash falls under rate of the hash space, so every op on a sampled
+// key is kept and the sample behaves like the whole trace scaled down by
+// rate. A cache of capacity * rate entries then sees about the hit ratio of
+// a capacity sized cache on the full trace.
+//
+// Under skewed keys how many of the few hottest keys land in the sample
+// swings the sample's size, so estimates are corrected as in SHARDS_adj: the
+// gets the sample is short of its expected rate * gets are assumed to be to
+// hot keys, and counted as hits at every capacity (or, if the sample is
+// over, taken off the hits).
+//
+// The pass over the trace only filters it, the cache replays run over the
+// much smaller sample, one capacity at a time on each of the threads.
+
+// Sampled if the top 24 bits of the key's mixed hash fall under threshold
+static constexpr int samplebits = 24;
+
+// The default rate keeps about this many ops, within the rates below
+static constexpr double targetops = 1 << 17;
+static constexpr double minrate = 0.001;
+static constexpr double maxrate = 0.1;
+
+// Scaled caches smaller than this give rough estimates
+static constexpr int fewentries = 32;
+
+static uint32_t sampleHash(int32_t key) {
+    // splitmix64, so nearby keys sample independently. The increment keeps
+    // key 0, which the finalizer alone maps to 0, from always being sampled.
+    uint64_t x = (uint32_t)key + 0x9e3779b97f4a7c15ull;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x >> (64 - samplebits);
+}
+
+struct Outcome {
+    uint64_t gets;
+    uint64_t hits;
+};
+
+// Gets and hits of ops through a cache from make()
+template <typename Make>
+Outcome replay(const TraceOp* begin, const TraceOp* end, Make make) {
+    auto cache = make();
+    uint64_t gets = 0, hits = 0;
+    for (const TraceOp* op = begin; op != end; op++) {
+        if (op->op == 'g') {
+            gets++;
+            hits += cache->get(op->key) != nullptr;
+        }
+        else
+            cache->put(op->key, op->val);
+    }
+    return {gets, hits};
+}
+
+// Outcome of engine at capacity over ops, or gets and hits of UINT64_MAX if
+// there is no such engine
+Outcome run(const std::string& engine, int capacity, const TraceOp* begin, const TraceOp* end) {
+    if (engine == "lfu")
+        return replay(begin, end, [&]() { return std::make_unique<LFUCacheMark<int,int>>(capacity); });
+    if (engine == "lfu-aging")
+        return replay(begin, end, [&]() { return std::make_unique<LFUCacheMark<int,int>>(capacity, true, true); });
+    if (engine == "lru")
+        return replay(begin, end, [&]() { return std::make_unique<LRUCache<int,int>>(capacity); });
+    if (engine == "arc")
+        return replay(begin, end, [&]() { return std::make_unique<ARCCache<int,int>>(capacity); });
+    if (engine == "tinylfu")
+        return replay(begin, end, [&]() { return std::make_unique<WTinyLFUCache<int,int>>(capacity); });
+    return {UINT64_MAX, UINT64_MAX};
+}
+
+// Runs job(i) for every i below n on nthreads threads
+template <typename Job>
+void parallel(std::size_t n, unsigned nthreads, Job job) {
+    std::atomic<std::size_t> next (0);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < std::min<std::size_t>(nthreads, n); t++) {
+        threads.emplace_back([&]() {
+            for (std::size_t i; (i = next.fetch_add(1)) < n;)
+                job(i);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+// mrc [options] trace
+//   --engine e        lfu, lfu-aging, lru, arc or tinylfu (lfu)
+//   --capacities a,b  capacities to report (10 points from 10 to 100000)
+//   --rate r          fraction of keys sampled, 1 replays everything
+//                     (enough to sample about 2^17 ops, from 0.001 to 0.1)
+//   --threads n       replay threads (all cores)
+//   --verify          also replay the full trace at every capacity and
+//                     report the error
+// Prints one line per capacity: capacity, estimated hit ratio and, with
+// --verify, the full replay's hit ratio and the difference.
+int main(int argc, char** argv) {
+    std::string engine = "lfu";
+    std::vector<int> capacities;
+    double rate = -1;
+    unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+    bool verify = false;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (std::strcmp(argv[i], "--engine") == 0 and more)
+            engine = argv[++i];
+        else if (std::strcmp(argv[i], "--capacities") == 0 and more) {
+            for (char* s = argv[++i]; *s != '\0';) {
+                capacities.push_back(std::strtol(s, &s, 10));
+                if (*s == ',')
+                    s++;
+                else if (*s != '\0')
+                    break;
+            }
+        }
+        else if (std::strcmp(argv[i], "--rate") == 0 and more)
+            rate = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--threads") == 0 and more)
+            nthreads = std::max(1, std::atoi(argv[++i]));
+        else if (std::strcmp(argv[i], "--verify") == 0)
+            verify = true;
+        else if (argv[i][0] != '-' and path == nullptr)
+            path = argv[i];
+        else {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (capacities.empty()) {
+        for (int p = 0; p < 10; p++)
+            capacities.push_back((int)std::lround(10 * std::pow(10000.0, p / 9.0)));
+    }
+    std::sort(capacities.begin(), capacities.end());
+    capacities.erase(std::unique(capacities.begin(), capacities.end()), capacities.end());
+    if (path == nullptr or capacities.front() <= 0 or (rate != -1 and (rate <= 0 or rate > 1))
+        or run(engine, 1, nullptr, nullptr).gets == UINT64_MAX) {
+        std::cerr << "Usage: mrc [--engine e] [--capacities a,b,...] [--rate r] [--threads n] "
+                  << "[--verify] trace" << std::endl;
+        return 1;
+    }
+
+    Trace ops;
+    if (not ops.map(path)) {
+        std::cerr << "Could not load ops from " << path << std::endl;
+        return 1;
+    }
+    if (rate == -1)
+        rate = std::min(maxrate, std::max(minrate, targetops / std::max<std::size_t>(ops.size(), 1)));
+
+    // The one pass over the trace
+    uint32_t threshold = (uint32_t)std::min(rate * (1 << samplebits), (double)(1 << samplebits));
+    std::vector<TraceOp> sample;
+    uint64_t gets = 0;
+    if (rate < 1) {
+        for (const TraceOp& op : ops) {
+            gets += op.op == 'g';
+            if (sampleHash(op.key) < threshold)
+                sample.push_back(op);
+        }
+    }
+    const TraceOp* begin = rate < 1 ? sample.data() : ops.begin();
+    const TraceOp* end = rate < 1 ? sample.data() + sample.size() : ops.end();
+
+    std::size_t n = capacities.size();
+    std::vector<double> estimates (n), full (n);
+    parallel(verify ? 2 * n : n, nthreads, [&](std::size_t i) {
+        if (i < n) {
+            int scaled = std::max(1, (int)std::lround(capacities[i] * rate));
+            Outcome res = run(engine, scaled, begin, end);
+            double expected = rate < 1 ? gets * rate : res.gets;
+            double adjusted = res.hits + (expected - res.gets);
+            estimates[i] = expected > 0 ? std::min(1.0, std::max(0.0, adjusted / expected)) : 0;
+        }
+        else {
+            Outcome res = run(engine, capacities[i - n], ops.begin(), ops.end());
+            full[i - n] = res.gets > 0 ? (double)res.hits / res.gets : 0;
+        }
+    });
+
+    std::cout << "# " << engine << ", " << ops.size() << " ops, rate " << rate
+              << ", " << (end - begin) << " ops sampled" << std::endl;
+    std::cout << "# capacity hit_ratio" << (verify ? " full_hit_ratio error" : "") << std::endl;
+    double worst = 0;
+    for (std::size_t i = 0; i < n; i++) {
+        std::cout << capacities[i] << " " << estimates[i];
+        if (verify) {
+            std::cout << " " << full[i] << " " << estimates[i] - full[i];
+            worst = std::max(worst, std::fabs(estimates[i] - full[i]));
+        }
+        std::cout << std::endl;
+    }
+    if (verify)
+        std::cout << "# largest error " << worst << std::endl;
+    if (rate < 1 and capacities.front() * rate < fewentries) {
+        std::cout << "# capacities under " << (int)std::ceil(fewentries / rate)
+                  << " are estimated from fewer than " << fewentries << " sampled entries" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Fixed-size node allocator. Nodes are carved out of contiguous slabs of
+// slabsize nodes each and released nodes are threaded onto a free list, so
+// once the pool has grown to its working size create/destroy never touch the
+// underlying allocator. An unpooled NodePool passes every node straight to
+// the allocator instead.
+template <typename T, typename Alloc = std::allocator<T>>
+class NodePool {
+    private:
+        union Slot {
+            Slot* next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        using SlotAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<Slot>;
+        using SlotTraits = std::allocator_traits<SlotAlloc>;
+
+        SlotAlloc alloc;
+
+        std::vector<Slot*> slabs;
+
+        // Released nodes
+        Slot* freelist;
+
+        // Untouched part of the newest slab
+        Slot* cursor;
+        Slot* end;
+
+        std::size_t slabsize;
+
+        bool pooled;
+
+        // Nodes handed out and not yet destroyed
+        std::size_t live;
+
+        void grow(void) {
+            Slot* slab = SlotTraits::allocate(alloc, slabsize);
+            slabs.push_back(slab);
+            cursor = slab;
+            end = slab + slabsize;
+        }
+
+        void release(Slot* slot) {
+            live--;
+            if (not pooled) {
+                SlotTraits::deallocate(alloc, slot, 1);
+                return;
+            }
+            slot->next = freelist;
+            freelist = slot;
+        }
+
+    public:
+        // capacity is the number of nodes in each slab, normally the number
+        // of nodes the owner expects to have live at once
+        explicit NodePool(std::size_t capacity, bool pooled = true, const Alloc& alloc = Alloc())
+            : alloc(alloc), freelist(nullptr), cursor(nullptr), end(nullptr),
+              slabsize(capacity > 0 ? capacity : 1), pooled(pooled), live(0) {}
+
+        NodePool(const NodePool&) = delete;
+        NodePool& operator=(const NodePool&) = delete;
+
+        // Nodes still live when the pool dies are not destroyed
+        ~NodePool(void) {
+            for (Slot* slab : slabs)
+                SlotTraits::deallocate(alloc, slab, slabsize);
+        }
+
+        template <typename... Args>
+        T* create(Args&&... args) {
+            Slot* slot;
+            if (not pooled)
+                slot = SlotTraits::allocate(alloc, 1);
+            else if (freelist != nullptr) {
+                slot = freelist;
+                freelist = freelist->next;
+            }
+            else {
+                if (cursor == end)
+                    grow();
+                slot = cursor++;
+            }
+            live++;
+            return new (slot->storage) T{std::forward<Args>(args)...};
+        }
+
+        void destroy(T* node) {
+            node->~T();
+            release(reinterpret_cast<Slot*>(node));
+        }
+
+        // Destroys node and builds a new one in the same memory
+        template <typename... Args>
+        T* recycle(T* node, Args&&... args) {
+            node->~T();
+            try {
+                return new (node) T{std::forward<Args>(args)...};
+            }
+            catch (...) {
+                release(reinterpret_cast<Slot*>(node));
+                throw;
+            }
+        }
+
+        // Bytes held for nodes, live or not
+        std::size_t bytes(void) const {
+            if (not pooled)
+                return live * sizeof(Slot);
+            return slabs.size() * slabsize * sizeof(Slot);
+        }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware counters for this thread through perf_event_open, counting user
+// space only so they work at the default perf_event_paranoid of 2. Each
+// counter is opened on its own, so one the CPU or the kernel does not offer
+// (as under most VMs, or where perf events are forbidden outright) is simply
+// missing instead of taking the others down with it.
+class PerfCounters {
+    public:
+        enum Counter {
+            cycles,
+            instructions,
+            l1dmisses,
+            llcmisses,
+            branchmisses,
+            dtlbmisses,
+            ncounters,
+        };
+
+        static constexpr const char* names[ncounters] = {
+            "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "dtlb_misses",
+        };
+
+    private:
+        int fds[ncounters];
+        uint64_t counts[ncounters];
+
+        static uint64_t cacheMiss(uint64_t cache) {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+
+        static int open(uint32_t type, uint64_t config) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // Scale for time lost to multiplexing when there are more
+            // counters than the PMU has registers
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+
+    public:
+        PerfCounters(void) {
+            fds[cycles] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            fds[instructions] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            fds[l1dmisses] = open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1D));
+            fds[llcmisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            fds[branchmisses] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            fds[dtlbmisses] = open(PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_DTLB));
+            for (int c = 0; c < ncounters; c++)
+                counts[c] = 0;
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters(void) {
+            for (int fd : fds) {
+                if (fd >= 0)
+                    close(fd);
+            }
+        }
+
+        // Whether any counter opened
+        bool any(void) const {
+            for (int fd : fds) {
+                if (fd >= 0)
+                    return true;
+            }
+            return false;
+        }
+
+        bool available(Counter c) const {
+            return fds[c] >= 0;
+        }
+
+        // Zeroes and starts every counter that opened
+        void start(void) {
+            for (int fd : fds) {
+                if (fd >= 0) {
+                    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+                }
+            }
+        }
+
+        // Stops the counters and reads them. A counter whose read fails is
+        // closed and treated as unavailable from then on.
+        void stop(void) {
+            for (int fd : fds) {
+                if (fd >= 0)
+                    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            }
+            for (int c = 0; c < ncounters; c++) {
+                if (fds[c] < 0)
+                    continue;
+                uint64_t value[3];
+                if (read(fds[c], value, sizeof(value)) != sizeof(value)) {
+                    close(fds[c]);
+                    fds[c] = -1;
+                    continue;
+                }
+                // value is the count, time enabled and time running
+                counts[c] = value[2] > 0 and value[2] < value[1]
+                    ? (uint64_t)((double)value[0] * value[1] / value[2]) : value[0];
+            }
+        }
+
+        // Count from the last start/stop, 0 if unavailable
+        uint64_t count(Counter c) const {
+            return fds[c] >= 0 ? counts[c] : 0;
+        }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "flatindex.h"
+
+// Approximate LFU in the style of Redis's allkeys-lfu. There are no frequency
+// lists: entries sit in one dense array in no particular order, each with an
+// 8-bit logarithmic counter and the 16-bit decay period it was last touched
+// in. A hit bumps the counter with probability 1 / ((counter - initial) *
+// logFactor + 1), so 255 stands for roughly a million hits at the default
+// factor, and the counter loses one for every decay period it goes untouched.
+// A full cache evicts the lowest counter among samples random entries.
+//
+// Time is counted in operations: every decayPeriod gets and puts start a new
+// period. Entries are 3 bytes bigger than the key and value plus padding,
+// and a hit touches only the entry and its index slot.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class SampledLFUCache {
+    private:
+        // Counter given to new entries, so they survive a few evictions
+        static constexpr uint8_t initial = 5;
+
+        struct Entry {
+            Key key;
+            Value val;
+            uint16_t stamp;
+            uint8_t counter;
+
+            template <typename K, typename V>
+            Entry(K&& key, V&& val, uint16_t stamp)
+                : key(std::forward<K>(key)), val(std::forward<V>(val)),
+                  stamp(stamp), counter(initial) {}
+        };
+
+        template <typename T>
+        using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+        using Slot = typename FlatIndex<uint32_t, Rebind<uint32_t>>::Slot;
+
+        FlatIndex<uint32_t, Rebind<uint32_t>> index;
+        std::vector<Entry, Rebind<Entry>> entries;
+
+        int maxcap;
+        int samples;
+        uint32_t logFactor;
+
+        // Ops left in the current decay period and the period's number
+        uint32_t decayPeriod;
+        uint32_t ticks;
+        uint16_t period;
+
+        // xorshift64* state for sampling and counter increments
+        uint64_t rng;
+
+        Hash hasher;
+        KeyEqual equal;
+
+        uint64_t random(void) {
+            rng ^= rng >> 12;
+            rng ^= rng << 25;
+            rng ^= rng >> 27;
+            return rng * 0x2545f4914f6cdd1dull;
+        }
+
+        void tick(void) {
+            if (--ticks == 0) {
+                ticks = decayPeriod;
+                period++;
+            }
+        }
+
+        template <typename K>
+        Slot* lookup(const K& key, std::size_t hash) {
+            return index.find(hash, [&](uint32_t i) { return equal(entries[i].key, key); });
+        }
+
+        // The counter with the decay for untouched periods taken off
+        uint8_t decayed(const Entry& e) const {
+            uint16_t idle = period - e.stamp;
+            return idle < e.counter ? e.counter - idle : 0;
+        }
+
+        void touch(Entry& e) {
+            uint8_t counter = decayed(e);
+            if (counter < 255) {
+                uint64_t base = counter > initial ? counter - initial : 0;
+                // Top 32 random bits below 2^32 / (base * logFactor + 1)
+                if ((random() >> 32) * (base * logFactor + 1) < ((uint64_t)1 << 32))
+                    counter++;
+            }
+            e.counter = counter;
+            e.stamp = period;
+        }
+
+        // Position of the lowest counter among the samples
+        uint32_t sample(void) {
+            uint32_t victim = 0;
+            int lowest = 256;
+            for (int i = 0; i < samples; i++) {
+                uint32_t pos = ((random() >> 32) * entries.size()) >> 32;
+                int counter = decayed(entries[pos]);
+                if (counter < lowest) {
+                    lowest = counter;
+                    victim = pos;
+                }
+            }
+            return victim;
+        }
+
+    public:
+        // decayPeriod defaults to 10 * capacity ops, which kept hit ratio
+        // close to the best on both stable and shifting Zipf traces
+        SampledLFUCache(int capacity, int samples = 5, uint32_t logFactor = 10, uint32_t decayPeriod = 0,
+                        const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                        const Alloc& alloc = Alloc())
+            : index(capacity, Rebind<uint32_t>(alloc)), entries(Rebind<Entry>(alloc)),
+              maxcap(capacity), samples(samples > 0 ? samples : 1), logFactor(logFactor),
+              period(0), rng(0x9e3779b97f4a7c15ull), hasher(hasher), equal(equal) {
+            if (decayPeriod == 0)
+                decayPeriod = capacity > 0 ? std::min<uint64_t>(10 * (uint64_t)capacity, UINT32_MAX) : 1;
+            this->decayPeriod = ticks = decayPeriod;
+            if (capacity > 0)
+                entries.reserve(capacity);
+        }
+
+        // Returns the cached value after counting a use, or nullptr. The
+        // pointer stays valid until the next put or extract.
+        template <typename K>
+        Value* get(const K& key) {
+            tick();
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return nullptr;
+            Entry& e = entries[slot->val];
+            touch(e);
+            return &e.val;
+        }
+
+        // Returns the cached value without counting a use or advancing the
+        // decay clock, or nullptr
+        template <typename K>
+        Value* peek(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            return slot != nullptr ? &entries[slot->val].val : nullptr;
+        }
+
+        // Inserts or overwrites the value for key, counting a use. A new key
+        // in a full cache takes the place of a sampled victim.
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            if (maxcap <= 0)
+                return;
+            tick();
+            std::size_t hash = hasher(key);
+            Slot* slot = lookup(key, hash);
+            if (slot != nullptr) {
+                Entry& e = entries[slot->val];
+                e.val = std::forward<V>(val);
+                touch(e);
+                return;
+            }
+            uint32_t pos;
+            if (entries.size() < (std::size_t)maxcap) {
+                pos = entries.size();
+                entries.emplace_back(std::forward<K>(key), std::forward<V>(val), period);
+            }
+            else {
+                pos = sample();
+                Entry& e = entries[pos];
+                index.erase(lookup(e.key, hasher(e.key)));
+                e.key = std::forward<K>(key);
+                e.val = std::forward<V>(val);
+                e.stamp = period;
+                e.counter = initial;
+            }
+            index.insert(hash)->val = pos;
+        }
+
+        // Removes key and moves its value out, if present. The last entry is
+        // moved into the hole to keep the array dense.
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            Slot* slot = lookup(key, hasher(key));
+            if (slot == nullptr)
+                return std::nullopt;
+            uint32_t pos = slot->val;
+            index.erase(slot);
+            std::optional<Value> val (std::move(entries[pos].val));
+            uint32_t last = entries.size() - 1;
+            if (pos != last) {
+                lookup(entries[last].key, hasher(entries[last].key))->val = pos;
+                entries[pos] = std::move(entries[last]);
+            }
+            entries.pop_back();
+            return val;
+        }
+
+        std::size_t size(void) const {
+            return entries.size();
+        }
+
+        int capacity(void) const {
+            return maxcap;
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) + index.bytes() + entries.capacity() * sizeof(Entry);
+        }
+};
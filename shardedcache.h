@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "markcache.h"
+
+// Thread-safe front-end over independent LFUCacheMark shards. Each key hashes
+// to one shard, and each shard has its own lock and sits on its own cache
+// lines, so threads working on different shards never contend. Eviction is
+// exact LFU within a shard and approximate across the whole cache.
+//
+// With one shard this is the plain cache behind a single mutex.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class ShardedLFUCache {
+    private:
+        using Cache = LFUCacheMark<Key, Value, Hash, KeyEqual, Alloc>;
+
+        struct alignas(64) Shard {
+            std::mutex lock;
+            Cache cache;
+
+            Shard(int capacity, const Hash& hasher, const KeyEqual& equal, const Alloc& alloc)
+                : cache(capacity, true, false, hasher, equal, alloc) {}
+        };
+
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        Hash hasher;
+
+        // The shards' FlatIndexes take their slot from the top bits of
+        // hash * 2^64 / phi, so shards are picked from an unrelated mix of the
+        // hash (the murmur3 finalizer) to keep keys spread within each shard
+        template <typename K>
+        Shard& shardFor(const K& key) {
+            uint64_t h = hasher(key);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return *shards[((h & 0xffffffffull) * shards.size()) >> 32];
+        }
+
+    public:
+        // The capacity is split across nshards shards, the first
+        // capacity % nshards taking one entry more, so the shards add up to
+        // exactly capacity. There are never more shards than entries.
+        ShardedLFUCache(int capacity, int nshards = 16,
+                        const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                        const Alloc& alloc = Alloc())
+            : hasher(hasher) {
+            if (capacity > 0 and nshards > capacity)
+                nshards = capacity;
+            if (nshards < 1)
+                nshards = 1;
+            int shardcap = capacity > 0 ? capacity / nshards : 0;
+            int extra = capacity > 0 ? capacity % nshards : 0;
+            for (int i = 0; i < nshards; i++)
+                shards.push_back(std::make_unique<Shard>(shardcap + (i < extra), hasher, equal, alloc));
+        }
+
+        // Returns a copy of the cached value after counting a use. A pointer
+        // into the shard would not outlive its lock.
+        template <typename K>
+        std::optional<Value> get(const K& key) {
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard (shard.lock);
+            Value* val = shard.cache.get(key);
+            if (val == nullptr)
+                return std::nullopt;
+            return *val;
+        }
+
+        // get without counting a use
+        template <typename K>
+        std::optional<Value> peek(const K& key) {
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard (shard.lock);
+            Value* val = shard.cache.peek(key);
+            if (val == nullptr)
+                return std::nullopt;
+            return *val;
+        }
+
+        template <typename K, typename V>
+        void put(K&& key, V&& val) {
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard (shard.lock);
+            shard.cache.put(std::forward<K>(key), std::forward<V>(val));
+        }
+
+        template <typename K, typename... Args>
+        void emplace(K&& key, Args&&... args) {
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard (shard.lock);
+            shard.cache.emplace(std::forward<K>(key), std::forward<Args>(args)...);
+        }
+
+        template <typename K>
+        std::optional<Value> extract(const K& key) {
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard (shard.lock);
+            return shard.cache.extract(key);
+        }
+
+        std::size_t shardCount(void) const {
+            return shards.size();
+        }
+
+        // Sum over the shards, each counted under its own lock
+        std::size_t size(void) {
+            std::size_t total = 0;
+            for (auto& shard : shards) {
+                std::lock_guard<std::mutex> guard (shard->lock);
+                total += shard->cache.size();
+            }
+            return total;
+        }
+
+        std::size_t bytes(void) {
+            std::size_t total = sizeof(*this) + shards.capacity() * sizeof(shards[0]);
+            for (auto& shard : shards) {
+                std::lock_guard<std::mutex> guard (shard->lock);
+                total += shard->cache.bytes() - sizeof(Cache) + sizeof(Shard);
+            }
+            return total;
+        }
+};
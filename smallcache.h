@@ -0,0 +1,254 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Exact LFU cache of int keys for capacities fixed at compile time, meant for
+// a few dozen entries. There is no index and there are no lists: keys, use
+// counts and recency stamps sit in parallel arrays a few cache lines long, a
+// lookup compares the key against every slot at once with AVX2 or SSE2, and
+// eviction takes the least used slot, the least recently used on ties, with
+// a vector min over the counts and then over the stamps of the tied slots.
+// Without either instruction set the same scans run one slot at a time.
+//
+// Live entries fill slots [0, count). Slots past that keep the maximum count
+// and stamp so the min scans can run over whole vectors unmasked.
+template <std::size_t N, typename Value = int>
+class SmallLFUCache {
+    static_assert(N > 0, "SmallLFUCache needs room for at least one entry");
+
+    private:
+        // Slots padded to whole AVX2 vectors
+        static constexpr std::size_t slots = (N + 7) / 8 * 8;
+
+        static constexpr uint32_t none = UINT32_MAX;
+
+        alignas(64) int32_t keys[slots];
+        alignas(64) uint32_t uses[slots];
+        alignas(64) uint32_t stamps[slots];
+        Value vals[N];
+
+        uint32_t count;
+        uint32_t clock;
+
+#if defined(__AVX2__)
+        static uint32_t matches(const int32_t* at, __m256i needle) {
+            __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i*)at), needle);
+            return _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        }
+#elif defined(__SSE2__)
+        static uint32_t matches(const int32_t* at, __m128i needle) {
+            __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)at), needle);
+            return _mm_movemask_ps(_mm_castsi128_ps(eq));
+        }
+
+        static __m128i min32(__m128i a, __m128i b) {
+#if defined(__SSE4_1__)
+            return _mm_min_epu32(a, b);
+#else
+            // Unsigned compare by flipping the sign bits
+            __m128i bias = _mm_set1_epi32(INT32_MIN);
+            __m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(a, bias), _mm_xor_si128(b, bias));
+            return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+#endif
+        }
+
+        static uint32_t lanesMin(__m128i v) {
+            alignas(16) uint32_t lanes[4];
+            _mm_store_si128((__m128i*)lanes, v);
+            uint32_t lowest = lanes[0];
+            for (uint32_t lane : lanes)
+                lowest = lane < lowest ? lane : lowest;
+            return lowest;
+        }
+#endif
+
+        // Slot holding key among the first count, or -1
+        int find(int32_t key) const {
+#if defined(__AVX2__)
+            __m256i needle = _mm256_set1_epi32(key);
+            for (uint32_t i = 0; i < count; i += 8) {
+                uint32_t m = matches(keys + i, needle);
+                if (count - i < 8)
+                    m &= (1u << (count - i)) - 1;
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+#elif defined(__SSE2__)
+            __m128i needle = _mm_set1_epi32(key);
+            for (uint32_t i = 0; i < count; i += 4) {
+                uint32_t m = matches(keys + i, needle);
+                if (count - i < 4)
+                    m &= (1u << (count - i)) - 1;
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+#else
+            for (uint32_t i = 0; i < count; i++) {
+                if (keys[i] == key)
+                    return i;
+            }
+#endif
+            return -1;
+        }
+
+        // Slot of the least used entry, least recently used among equals.
+        // Stamps are unique, so the oldest stamp of the least used pins it.
+        int victim(void) const {
+#if defined(__AVX2__)
+            __m256i low = _mm256_load_si256((const __m256i*)uses);
+            for (std::size_t i = 8; i < slots; i += 8)
+                low = _mm256_min_epu32(low, _mm256_load_si256((const __m256i*)(uses + i)));
+            alignas(32) uint32_t lanes[8];
+            _mm256_store_si256((__m256i*)lanes, low);
+            uint32_t leastuses = lanes[0];
+            for (uint32_t lane : lanes)
+                leastuses = lane < leastuses ? lane : leastuses;
+            // Stamps of the least used, every other slot reads as none
+            __m256i target = _mm256_set1_epi32(leastuses);
+            __m256i oldest = _mm256_set1_epi32(none);
+            for (std::size_t i = 0; i < slots; i += 8) {
+                __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i*)(uses + i)), target);
+                __m256i stamp = _mm256_or_si256(_mm256_load_si256((const __m256i*)(stamps + i)),
+                                                _mm256_xor_si256(eq, _mm256_set1_epi32(-1)));
+                oldest = _mm256_min_epu32(oldest, stamp);
+            }
+            _mm256_store_si256((__m256i*)lanes, oldest);
+            uint32_t leaststamp = lanes[0];
+            for (uint32_t lane : lanes)
+                leaststamp = lane < leaststamp ? lane : leaststamp;
+            __m256i needle = _mm256_set1_epi32(leaststamp);
+            for (uint32_t i = 0;; i += 8) {
+                uint32_t m = matches((const int32_t*)stamps + i, needle);
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+#elif defined(__SSE2__)
+            __m128i low = _mm_load_si128((const __m128i*)uses);
+            for (std::size_t i = 4; i < slots; i += 4)
+                low = min32(low, _mm_load_si128((const __m128i*)(uses + i)));
+            __m128i target = _mm_set1_epi32(lanesMin(low));
+            __m128i oldest = _mm_set1_epi32(none);
+            for (std::size_t i = 0; i < slots; i += 4) {
+                __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(uses + i)), target);
+                __m128i stamp = _mm_or_si128(_mm_load_si128((const __m128i*)(stamps + i)),
+                                             _mm_xor_si128(eq, _mm_set1_epi32(-1)));
+                oldest = min32(oldest, stamp);
+            }
+            __m128i needle = _mm_set1_epi32(lanesMin(oldest));
+            for (uint32_t i = 0;; i += 4) {
+                uint32_t m = matches((const int32_t*)stamps + i, needle);
+                if (m != 0)
+                    return i + __builtin_ctz(m);
+            }
+#else
+            int best = 0;
+            for (uint32_t i = 1; i < count; i++) {
+                if (uses[i] < uses[best] or (uses[i] == uses[best] and stamps[i] < stamps[best]))
+                    best = i;
+            }
+            return best;
+#endif
+        }
+
+        // Next recency stamp. Before the clock reaches none the live stamps
+        // are renumbered 0..count-1 in the same order.
+        uint32_t tick(void) {
+            if (clock == none - 1) {
+                uint32_t renumbered[N];
+                for (uint32_t i = 0; i < count; i++) {
+                    renumbered[i] = 0;
+                    for (uint32_t j = 0; j < count; j++)
+                        renumbered[i] += stamps[j] < stamps[i];
+                }
+                for (uint32_t i = 0; i < count; i++)
+                    stamps[i] = renumbered[i];
+                clock = count;
+            }
+            return clock++;
+        }
+
+        void touch(int slot) {
+            // Saturates below none, which marks unused slots
+            if (uses[slot] < none - 1)
+                uses[slot]++;
+            stamps[slot] = tick();
+        }
+
+    public:
+        SmallLFUCache(void) : vals(), count(0), clock(0) {
+            for (std::size_t i = 0; i < slots; i++) {
+                keys[i] = 0;
+                uses[i] = none;
+                stamps[i] = none;
+            }
+        }
+
+        // Returns the cached value after counting a use, or nullptr. The
+        // pointer stays valid until the next put or extract.
+        Value* get(int key) {
+            int slot = find(key);
+            if (slot < 0)
+                return nullptr;
+            touch(slot);
+            return &vals[slot];
+        }
+
+        // Returns the cached value without counting a use, or nullptr
+        Value* peek(int key) {
+            int slot = find(key);
+            return slot >= 0 ? &vals[slot] : nullptr;
+        }
+
+        // Inserts or overwrites the value for key, counting a use
+        template <typename V>
+        void put(int key, V&& val) {
+            int slot = find(key);
+            if (slot >= 0) {
+                vals[slot] = std::forward<V>(val);
+                touch(slot);
+                return;
+            }
+            slot = count < N ? count++ : victim();
+            keys[slot] = key;
+            vals[slot] = std::forward<V>(val);
+            uses[slot] = 1;
+            stamps[slot] = tick();
+        }
+
+        // Removes key and moves its value out, if present. The last entry
+        // moves into its slot.
+        std::optional<Value> extract(int key) {
+            int slot = find(key);
+            if (slot < 0)
+                return std::nullopt;
+            std::optional<Value> val (std::move(vals[slot]));
+            uint32_t last = --count;
+            if ((uint32_t)slot != last) {
+                keys[slot] = keys[last];
+                vals[slot] = std::move(vals[last]);
+                uses[slot] = uses[last];
+                stamps[slot] = stamps[last];
+            }
+            uses[last] = none;
+            stamps[last] = none;
+            return val;
+        }
+
+        std::size_t size(void) const {
+            return count;
+        }
+
+        static constexpr std::size_t capacity(void) {
+            return N;
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this);
+        }
+};
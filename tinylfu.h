@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "lrucache.h"
+#include "markcache.h"
+
+// Count-min sketch of 4-bit counters, used to estimate how often a key has
+// been seen without keeping any per-key history. Counters live sixteen to a
+// 64-bit word and each key maps to four of them, one per hash function, with
+// the estimate the smallest of the four. After sampleSize increments every
+// counter is halved, so old popularity fades and the counters never saturate
+// for long.
+class FrequencySketch {
+    private:
+        static constexpr uint64_t seeds[4] = {
+            0xc3a5c85c97cb3127ull, 0xb492b66fbe98f273ull,
+            0x9ae16a3b2f90404full, 0xcbf29ce484222325ull
+        };
+
+        std::vector<uint64_t> table;
+
+        std::size_t mask;
+        std::size_t sampleSize;
+        std::size_t additions;
+
+        // Spreads hash for the ith function. The low bits pick the word and
+        // the top four the counter within it.
+        static uint64_t rehash(std::size_t hash, int i) {
+            uint64_t h = (hash + seeds[i]) * seeds[i];
+            return h ^ (h >> 32);
+        }
+
+        // Halves every counter, dropping the bit shifted across counters
+        void reset(void) {
+            for (uint64_t& word : table)
+                word = (word >> 1) & 0x7777777777777777ull;
+            additions /= 2;
+        }
+
+    public:
+        // Sized to one word, sixteen counters, per expected entry, rounded up
+        // to a power of 2
+        explicit FrequencySketch(std::size_t capacity) : additions(0) {
+            std::size_t words = 1;
+            while (words < capacity)
+                words <<= 1;
+            table.assign(words, 0);
+            mask = words - 1;
+            sampleSize = capacity > 0 ? 10 * capacity : 10;
+        }
+
+        int estimate(std::size_t hash) const {
+            int freq = 15;
+            for (int i = 0; i < 4; i++) {
+                uint64_t h = rehash(hash, i);
+                int shift = (h >> 60) << 2;
+                int count = (table[h & mask] >> shift) & 0xf;
+                if (count < freq)
+                    freq = count;
+            }
+            return freq;
+        }
+
+        void increment(std::size_t hash) {
+            bool added = false;
+            for (int i = 0; i < 4; i++) {
+                uint64_t h = rehash(hash, i);
+                int shift = (h >> 60) << 2;
+                uint64_t& word = table[h & mask];
+                if (((word >> shift) & 0xf) != 0xf) {
+                    word += 1ull << shift;
+                    added = true;
+                }
+            }
+            if (added and ++additions == sampleSize)
+                reset();
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) + table.capacity() * sizeof(uint64_t);
+        }
+};
+
+// LFU cache with W-TinyLFU admission. New keys land in a small LRU window
+// (1% of the capacity) and every get and put is counted in a FrequencySketch.
+// When the window overflows its least recently used key becomes a candidate
+// for the main LFUCacheMark region, and once that region is full the
+// candidate only gets in if the sketch has seen it more often than the
+// region's victim. Otherwise the candidate is dropped, so a one-off scan
+// passes through the window without flushing the main region.
+template <typename Key, typename Value,
+          typename Hash = std::hash<Key>,
+          typename KeyEqual = std::equal_to<Key>,
+          typename Alloc = std::allocator<std::pair<const Key, Value>>>
+class WTinyLFUCache {
+    private:
+        LRUCache<Key, Value, Hash, KeyEqual, Alloc> window;
+        LFUCacheMark<Key, Value, Hash, KeyEqual, Alloc> main;
+
+        FrequencySketch sketch;
+
+        Hash hasher;
+
+        static int windowSize(int capacity) {
+            if (capacity <= 0)
+                return 0;
+            return capacity / 100 > 0 ? capacity / 100 : 1;
+        }
+
+        // Moves the window's least recently used into the main region if it
+        // has room or the candidate is used more often than the main victim
+        void admit(void) {
+            std::optional<std::pair<Key,Value>> candidate = window.evict();
+            if (main.size() >= (std::size_t)main.capacity()) {
+                const Key* victim = main.victim();
+                if (victim == nullptr or sketch.estimate(hasher(candidate->first)) <= sketch.estimate(hasher(*victim)))
+                    return;
+            }
+            main.put(std::move(candidate->first), std::move(candidate->second));
+        }
+
+    public:
+        WTinyLFUCache(int capacity, const Hash& hasher = Hash(), const KeyEqual& equal = KeyEqual(),
+                      const Alloc& alloc = Alloc())
+            : window(windowSize(capacity), hasher, equal, alloc),
+              main(capacity - windowSize(capacity), true, false, hasher, equal, alloc),
+              sketch(capacity > 0 ? capacity : 0), hasher(hasher) {}
+
+        // Returns the cached value after counting a use, or nullptr. The
+        // pointer stays valid until the next put.
+        Value* get(const Key& key) {
+            sketch.increment(hasher(key));
+            if (Value* val = window.get(key))
+                return val;
+            return main.get(key);
+        }
+
+        // Returns the cached value without counting a use, or nullptr
+        Value* peek(const Key& key) {
+            if (Value* val = window.peek(key))
+                return val;
+            return main.peek(key);
+        }
+
+        // Inserts or overwrites the value for key, counting a use
+        template <typename V>
+        void put(const Key& key, V&& val) {
+            sketch.increment(hasher(key));
+            if (Value* cur = window.get(key)) {
+                *cur = std::forward<V>(val);
+                return;
+            }
+            if (Value* cur = main.get(key)) {
+                *cur = std::forward<V>(val);
+                return;
+            }
+            if (window.capacity() <= 0)
+                return;
+            if (window.size() >= (std::size_t)window.capacity())
+                admit();
+            window.put(key, std::forward<V>(val));
+        }
+
+        // Removes key and moves its value out, if present
+        std::optional<Value> extract(const Key& key) {
+            if (std::optional<Value> val = window.extract(key))
+                return val;
+            return main.extract(key);
+        }
+
+        std::size_t size(void) const {
+            return window.size() + main.size();
+        }
+
+        std::size_t bytes(void) const {
+            return sizeof(*this) - sizeof(window) - sizeof(main) - sizeof(sketch)
+                + window.bytes() + main.bytes() + sketch.bytes();
+        }
+};
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One get or put of a trace. Gets leave val 0.
+struct TraceOp {
+    int32_t key;
+    int32_t val;
+    // 'g' or 'p'
+    char op;
+    char pad[3];
+};
+
+static_assert(sizeof(TraceOp) == 12, "TraceOp records are packed in trace files");
+
+// A binary trace file is this header followed by count TraceOps, in host byte
+// order. opsize lets a reader reject records laid out differently.
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t opsize;
+    uint64_t count;
+};
+
+static constexpr char tracemagic[8] = {'L', 'F', 'U', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t traceversion = 1;
+
+// Writes a binary trace file a record at a time through a large stdio buffer.
+// The header's count is filled in by close(), so writers need not know how
+// many ops they will produce.
+class TraceWriter {
+    private:
+        std::string path;
+        std::FILE* out;
+        uint64_t count;
+        bool ok;
+
+    public:
+        TraceWriter(void) : out(nullptr), count(0), ok(false) {}
+
+        TraceWriter(const TraceWriter&) = delete;
+        TraceWriter& operator=(const TraceWriter&) = delete;
+
+        ~TraceWriter(void) {
+            if (out != nullptr) {
+                ok = false;
+                close();
+            }
+        }
+
+        bool open(const char* path) {
+            this->path = path;
+            out = std::fopen(path, "wb");
+            if (out == nullptr)
+                return false;
+            std::setvbuf(out, nullptr, _IOFBF, 1 << 20);
+            count = 0;
+            TraceHeader header = {};
+            ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+            return ok;
+        }
+
+        void write(const TraceOp& op) {
+            ok = ok and std::fwrite(&op, sizeof(op), 1, out) == 1;
+            count++;
+        }
+
+        // Finishes the file, removing it if anything failed or failed is set
+        bool close(bool failed = false) {
+            TraceHeader header;
+            std::memcpy(header.magic, tracemagic, sizeof(tracemagic));
+            header.version = traceversion;
+            header.opsize = sizeof(TraceOp);
+            header.count = count;
+            ok = ok and not failed and std::fseek(out, 0, SEEK_SET) == 0
+                and std::fwrite(&header, sizeof(header), 1, out) == 1;
+            ok = std::fclose(out) == 0 and ok;
+            out = nullptr;
+            if (not ok)
+                std::remove(path.c_str());
+            return ok;
+        }
+};
+
+// The ops of a trace, read either from the text format (a count, then one
+// "g key" or "p key val" per line) or by mapping a binary trace file, whose
+// records are then replayed in place with no parsing or copying
+class Trace {
+    private:
+        // Ops read from text
+        std::vector<TraceOp> owned;
+
+        const TraceOp* ops;
+        std::size_t count;
+
+        void* mapping;
+        std::size_t mapped;
+
+        void unmap(void) {
+            if (mapping != nullptr)
+                munmap(mapping, mapped);
+            mapping = nullptr;
+            mapped = 0;
+        }
+
+        // Parses the next text op into op, returns false at the end of in
+        static bool parse(std::istream& in, TraceOp& op) {
+            int key, val = 0;
+            char type;
+            if (not (in >> type >> key))
+                return false;
+            if (type != 'g' and not (in >> val))
+                return false;
+            std::memset(&op, 0, sizeof(op));
+            op.key = key;
+            op.val = val;
+            op.op = type;
+            return true;
+        }
+
+    public:
+        Trace(void) : ops(nullptr), count(0), mapping(nullptr), mapped(0) {}
+
+        Trace(const Trace&) = delete;
+        Trace& operator=(const Trace&) = delete;
+
+        ~Trace(void) {
+            unmap();
+        }
+
+        // Reads a text trace, returns false if it is malformed
+        bool read(std::istream& in) {
+            unmap();
+            uint64_t n;
+            if (not (in >> n))
+                return false;
+            owned.resize(n);
+            for (uint64_t i = 0; i < n; i++) {
+                if (not parse(in, owned[i]))
+                    return false;
+            }
+            ops = owned.data();
+            count = owned.size();
+            return true;
+        }
+
+        // Maps a binary trace, returns false if it cannot be opened or is not
+        // one
+        bool map(const char* path) {
+            unmap();
+            owned.clear();
+            int fd = open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 or (std::size_t)st.st_size < sizeof(TraceHeader)) {
+                close(fd);
+                return false;
+            }
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            // The mapping keeps the file alive
+            close(fd);
+            if (addr == MAP_FAILED)
+                return false;
+            mapping = addr;
+            mapped = st.st_size;
+            const TraceHeader* header = (const TraceHeader*)addr;
+            if (std::memcmp(header->magic, tracemagic, sizeof(tracemagic)) != 0
+                or header->version != traceversion or header->opsize != sizeof(TraceOp)
+                or header->count > (mapped - sizeof(TraceHeader)) / sizeof(TraceOp)) {
+                unmap();
+                return false;
+            }
+            // Replays walk the records front to back
+            madvise(addr, mapped, MADV_SEQUENTIAL);
+            ops = (const TraceOp*)(header + 1);
+            count = header->count;
+            return true;
+        }
+
+        // Converts a text trace into a binary trace file at path. Returns
+        // false if the text is malformed or path cannot be written.
+        static bool convert(std::istream& in, const char* path) {
+            uint64_t n;
+            if (not (in >> n))
+                return false;
+            TraceWriter out;
+            if (not out.open(path))
+                return false;
+            TraceOp op;
+            for (uint64_t i = 0; i < n; i++) {
+                if (not parse(in, op))
+                    return out.close(true);
+                out.write(op);
+            }
+            return out.close();
+        }
+
+        std::size_t size(void) const {
+            return count;
+        }
+
+        const TraceOp& operator[](std::size_t i) const {
+            return ops[i];
+        }
+
+        const TraceOp* begin(void) const {
+            return ops;
+        }
+
+        const TraceOp* end(void) const {
+            return ops + count;
+        }
+};
@@ -0,0 +1,190 @@
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "trace.h"
+
+// Seeded generator of benchmark traces. Random numbers come from xorshift64*
+// and every distribution is computed here rather than through <random>, so a
+// seed produces the same trace whatever the standard library. The Zipf
+// sampler still goes through libm functions like std::exp and std::log, whose
+// last bits vary between libms, so skewed traces are only reproducible with
+// the same toolchain and libm.
+class Workload {
+    private:
+        uint64_t state;
+
+        // Zipf over ranks 1..keys by rejection-inversion (Hormann and
+        // Derflinger), constant time per sample for any number of keys
+        double skew;
+        double hx1, hn, sc;
+
+        uint64_t keys;
+
+        // Ranks are rotated by offset, redrawn every shift ops
+        uint64_t shift;
+        uint64_t offset;
+
+        // Every scanevery ops a scan of scanlen consecutive keys runs,
+        // carrying on from where the last scan stopped
+        uint64_t scanevery;
+        uint64_t scanlen;
+        uint64_t cursor;
+
+        double reads;
+
+        uint64_t emitted;
+        uint64_t scanleft;
+
+        uint64_t next(void) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 2685821657736338717ull;
+        }
+
+        // Uniform in [0, 1)
+        double unit(void) {
+            return (next() >> 11) * 0x1.0p-53;
+        }
+
+        // (exp(x) - 1) / x and log(1 + x) / x, accurate near 0
+        static double expm1x(double x) {
+            return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1 + x / 2 * (1 + x / 3);
+        }
+
+        static double log1px(double x) {
+            return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x / 3);
+        }
+
+        double h(double x) const {
+            return std::exp(-skew * std::log(x));
+        }
+
+        double hIntegral(double x) const {
+            double logx = std::log(x);
+            return expm1x((1 - skew) * logx) * logx;
+        }
+
+        double hIntegralInverse(double x) const {
+            double t = x * (1 - skew);
+            if (t < -1)
+                t = -1;
+            return std::exp(log1px(t) * x);
+        }
+
+        uint64_t zipf(void) {
+            for (;;) {
+                double u = hn + unit() * (hx1 - hn);
+                double x = hIntegralInverse(u);
+                double k = std::floor(x + 0.5);
+                if (k < 1)
+                    k = 1;
+                else if (k > keys)
+                    k = keys;
+                if (k - x <= sc or u >= hIntegral(k + 0.5) - h(k))
+                    return (uint64_t)k - 1;
+            }
+        }
+
+    public:
+        // A skew of 0 draws keys uniformly
+        Workload(uint64_t seed, uint64_t keys, double skew, double reads,
+                 uint64_t shift, uint64_t scanevery, uint64_t scanlen)
+            : state(seed * 0x9e3779b97f4a7c15ull + 1), skew(skew), keys(keys), shift(shift),
+              offset(0), scanevery(scanevery), scanlen(scanlen), cursor(0), reads(reads),
+              emitted(0), scanleft(0) {
+            hx1 = hIntegral(1.5) - 1;
+            hn = hIntegral(keys + 0.5);
+            sc = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+        }
+
+        TraceOp op(void) {
+            if (shift > 0 and emitted > 0 and emitted % shift == 0)
+                offset = next() % keys;
+            if (scanevery > 0 and emitted > 0 and emitted % scanevery == 0)
+                scanleft = scanlen;
+            emitted++;
+
+            uint64_t key;
+            if (scanleft > 0) {
+                scanleft--;
+                key = cursor;
+                cursor = (cursor + 1) % keys;
+            }
+            else {
+                uint64_t rank = skew > 0 ? zipf() : next() % keys;
+                key = (rank + offset) % keys;
+            }
+
+            TraceOp op = {};
+            op.key = (int32_t)key;
+            if (unit() < reads)
+                op.op = 'g';
+            else {
+                op.op = 'p';
+                op.val = (int32_t)(next() >> 33);
+            }
+            return op;
+        }
+};
+
+// tracegen [options] trace
+//   --ops n          ops to generate (10000000)
+//   --keys n         size of the key space, keys are 0..n-1 (100)
+//   --zipf s         Zipf skew, 0 for uniform keys (0)
+//   --reads f        fraction of ops that are gets (0.5)
+//   --shift n        move the hot keys to a random spot every n ops (never)
+//   --scan n len     every n ops, scan len keys in order (never)
+//   --seed n         random seed (1)
+int main(int argc, char** argv) {
+    uint64_t ops = 10000000, keys = 100, seed = 1, shift = 0, scanevery = 0, scanlen = 0;
+    double skew = 0, reads = 0.5;
+    const char* path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+        if (std::strcmp(argv[i], "--ops") == 0 and more)
+            ops = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--keys") == 0 and more)
+            keys = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--zipf") == 0 and more)
+            skew = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--reads") == 0 and more)
+            reads = std::strtod(argv[++i], nullptr);
+        else if (std::strcmp(argv[i], "--shift") == 0 and more)
+            shift = std::strtoull(argv[++i], nullptr, 10);
+        else if (std::strcmp(argv[i], "--scan") == 0 and i + 2 < argc) {
+            scanevery = std::strtoull(argv[++i], nullptr, 10);
+            scanlen = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 and more)
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (argv[i][0] != '-' and path == nullptr)
+            path = argv[i];
+        else {
+            std::cerr << "Unknown argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (path == nullptr or keys == 0 or keys > (uint64_t)INT32_MAX + 1 or skew < 0) {
+        std::cerr << "Usage: tracegen [--ops n] [--keys n] [--zipf s] [--reads f] "
+                  << "[--shift n] [--scan n len] [--seed n] trace" << std::endl;
+        return 1;
+    }
+
+    TraceWriter out;
+    if (not out.open(path)) {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+    }
+    Workload workload (seed, keys, skew, reads, shift, scanevery, scanlen);
+    for (uint64_t i = 0; i < ops; i++)
+        out.write(workload.op());
+    if (not out.close()) {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+    }
+    return 0;
+}